@@ -52,12 +52,19 @@ class BlockchainTest(BitcoinTestFramework):
         res = node.gettxoutsetinfo()
 
         assert_equal(res['total_amount'], Decimal('8725.00000000'))
-        assert_equal(res['transactions'], 200)
         assert_equal(res['height'], 200)
         assert_equal(res['txouts'], 200)
-        assert_equal(res['bytes_serialized'], 13924),
         assert_equal(len(res['bestblock']), 64)
-        assert_equal(len(res['hash_serialized']), 64)
+        assert_equal(len(res['muhash']), 64)
+
+        # Computing them from the database adds the database-specific fields
+        # and checks the maintained statistics
+        res2 = node.gettxoutsetinfo(True)
+        for key in ['total_amount', 'height', 'txouts', 'bogosize', 'bestblock', 'muhash']:
+            assert_equal(res2[key], res[key])
+        assert_equal(res2['transactions'], 200)
+        assert_equal(res2['bytes_serialized'], 13924)
+        assert_equal(res2['consistent'], True)
 
     def _test_getblockheader(self):
         node = self.nodes[0]
@@ -10,6 +10,8 @@
 #include <vector>
 #include <boost/thread/thread.hpp>
 #include "random.h"
+#include "crypto/sha256.h"
+#include "uint256.h"
 
 
 // This Benchmark tests the CheckQueue with the lightest
@@ -99,5 +101,47 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
+
+// This Benchmark tests how the CheckQueue scales with the number of worker
+// threads, with checks that each do about as much hashing as a signature
+// hash of a small transaction.
+static void CCheckQueueSpeedWorkers(benchmark::State& state, int nWorkers)
+{
+    struct HashJob {
+        uint256 hash;
+        bool operator()()
+        {
+            for (int i = 0; i < 4; i++)
+                CSHA256().Write(hash.begin(), 32).Finalize(hash.begin());
+            return true;
+        }
+        void swap(HashJob& x){std::swap(hash, x.hash);};
+    };
+    CCheckQueue<HashJob> queue {QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (auto x = 0; x < nWorkers - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        CCheckQueueControl<HashJob> control(&queue);
+        for (size_t x = 0; x < BATCHES; ++x) {
+            std::vector<HashJob> vChecks(BATCH_SIZE);
+            control.Add(vChecks);
+        }
+        control.Wait();
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void CCheckQueueSpeedWorkers1(benchmark::State& state) { CCheckQueueSpeedWorkers(state, 1); }
+static void CCheckQueueSpeedWorkers4(benchmark::State& state) { CCheckQueueSpeedWorkers(state, 4); }
+static void CCheckQueueSpeedWorkers16(benchmark::State& state) { CCheckQueueSpeedWorkers(state, 16); }
+static void CCheckQueueSpeedWorkers64(benchmark::State& state) { CCheckQueueSpeedWorkers(state, 64); }
+
 BENCHMARK(CCheckQueueSpeed);
 BENCHMARK(CCheckQueueSpeedPrevectorJob);
+BENCHMARK(CCheckQueueSpeedWorkers1);
+BENCHMARK(CCheckQueueSpeedWorkers4);
+BENCHMARK(CCheckQueueSpeedWorkers16);
+BENCHMARK(CCheckQueueSpeedWorkers64);
@@ -9,6 +9,7 @@
 #include "hash.h"
 #include "uint256.h"
 #include "utiltime.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -69,6 +70,19 @@ static void SipHash_32b(benchmark::State& state)
     }
 }
 
+static void MuHash_Insert(benchmark::State& state)
+{
+    MuHash3072 acc;
+    unsigned char key[32] = {0};
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++) {
+            key[0] = i;
+            key[1] = i >> 8;
+            acc.Insert(key, sizeof(key));
+        }
+    }
+}
+
 BENCHMARK(RIPEMD160);
 BENCHMARK(SHA1);
 BENCHMARK(SHA256);
@@ -76,3 +90,4 @@ BENCHMARK(SHA512);
 
 BENCHMARK(SHA256_32b);
 BENCHMARK(SipHash_32b);
+BENCHMARK(MuHash_Insert);
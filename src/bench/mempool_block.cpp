@@ -0,0 +1,63 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "policy/policy.h"
+#include "txmempool.h"
+
+#include <vector>
+
+static void AddTx(const CTransaction& tx, const CAmount& nFee, CTxMemPool& pool)
+{
+    int64_t nTime = 0;
+    double dPriority = 10.0;
+    unsigned int nHeight = 1;
+    bool spendsCoinbase = false;
+    unsigned int sigOpCost = 4;
+    LockPoints lp;
+    pool.addUnchecked(tx.GetHash(), CTxMemPoolEntry(
+                                        MakeTransactionRef(tx), nFee, nTime, dPriority, nHeight,
+                                        tx.GetValueOut(), spendsCoinbase, sigOpCost, lp));
+}
+
+// Fill the mempool with chains of unconfirmed transactions, then connect a
+// block confirming the first few transactions of each chain, so that the
+// remaining descendants all need their ancestor state updated.
+static void MempoolRemoveForBlock(benchmark::State& state)
+{
+    const int nChains = 100;
+    const int nChainLength = 25;
+    const int nConfirmed = 10;
+
+    std::vector<CTransactionRef> vtx;
+    std::vector<CTransactionRef> vtxBlock;
+    for (int i = 0; i < nChains; i++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].scriptSig = CScript() << i;
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_1 << OP_EQUAL;
+        tx.vout[0].nValue = 10 * COIN;
+        for (int j = 0; j < nChainLength; j++) {
+            CTransactionRef ptx = MakeTransactionRef(tx);
+            vtx.push_back(ptx);
+            if (j < nConfirmed)
+                vtxBlock.push_back(ptx);
+            tx.vin[0].prevout = COutPoint(ptx->GetHash(), 0);
+            tx.vin[0].scriptSig = CScript() << OP_1;
+        }
+    }
+
+    CTxMemPool pool(CFeeRate(1000));
+
+    while (state.KeepRunning()) {
+        for (const auto& ptx : vtx) {
+            AddTx(*ptx, 1000LL, pool);
+        }
+        pool.removeForBlock(vtxBlock, 1);
+        pool.clear();
+    }
+}
+
+BENCHMARK(MempoolRemoveForBlock);
@@ -0,0 +1,224 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+#include "random.h"
+#include "txdb.h"
+#include "util.h"
+#include "validation.h"
+#include "consensus/validation.h"
+#include "crypto/scrypt.h"
+#include "primitives/block.h"
+
+#include <boost/filesystem.hpp>
+
+// Scrypt is the dominant cost of checking headers, of reindexing and of
+// mining, so these cover the hash itself as well as its main callers.
+
+static CBlockHeader BenchHeader()
+{
+    CBlockHeader header = Params(CBaseChainParams::MAIN).GenesisBlock().GetBlockHeader();
+    header.hashPrevBlock = header.GetHash();
+    return header;
+}
+
+static void ScryptGenericTest(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    uint256 hash;
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        scrypt_1024_1_1_256_sp_generic(BEGIN(header.nVersion), BEGIN(hash), scratchpad);
+    }
+}
+
+#if defined(USE_SSE2)
+static void ScryptSSE2Test(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    uint256 hash;
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        scrypt_1024_1_1_256_sp_sse2(BEGIN(header.nVersion), BEGIN(hash), scratchpad);
+    }
+}
+#endif
+
+// Hashes SCRYPT_MAX_WAYS headers per iteration with the widest kernel the CPU supports
+static void ScryptMultiTest(benchmark::State& state)
+{
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    std::vector<CBlockHeader> headers(SCRYPT_MAX_WAYS, BenchHeader());
+    std::vector<uint256> hashes(SCRYPT_MAX_WAYS);
+    uint32_t nNonce = 0;
+    while (state.KeepRunning()) {
+        for (CBlockHeader& header : headers)
+            header.nNonce = nNonce++;
+        ComputePoWHashes(&headers[0], &hashes[0], headers.size());
+    }
+}
+
+// Reuses the calling thread's scratchpad
+static void ScryptPooledTest(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    uint256 hash;
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        scrypt_1024_1_1_256(BEGIN(header.nVersion), BEGIN(hash));
+    }
+}
+
+// Allocates a fresh scratchpad for every hash, paying for its page faults and TLB misses each time
+static void ScryptMallocTest(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    uint256 hash;
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        char* scratchpad = (char*)malloc(SCRYPT_SCRATCHPAD_SIZE);
+        scrypt_1024_1_1_256_sp(BEGIN(header.nVersion), BEGIN(hash), scratchpad);
+        free(scratchpad);
+    }
+}
+
+static void ScryptMultiHugePagesTest(benchmark::State& state)
+{
+    scrypt_set_huge_pages(true);
+    ScryptMultiTest(state);
+    scrypt_set_huge_pages(DEFAULT_SCRYPT_HUGE_PAGES);
+}
+
+static void GetPoWHashTest(benchmark::State& state)
+{
+    CBlockHeader header = BenchHeader();
+    while (state.KeepRunning()) {
+        header.nNonce++;
+        header.GetPoWHash();
+    }
+}
+
+static void CheckProofOfWorkTest(benchmark::State& state)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::MAIN).GetConsensus();
+    const CBlockHeader header = BenchHeader();
+    const uint256 hash = header.GetPoWHash();
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000; i++)
+            CheckProofOfWork(hash, header.nBits, params);
+    }
+}
+
+// Synthetic chain with DarkGravityWave active from the start and block times jittered around the target spacing
+static void BuildDGWChain(std::vector<CBlockIndex>& blocks, Consensus::Params& params)
+{
+    params = Params(CBaseChainParams::MAIN).GetConsensus();
+    params.nPowDGWHeight = 0;
+
+    FastRandomContext rng(true);
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : NULL;
+        blocks[i].nHeight = i;
+        blocks[i].nTime = 1500000000 + i * params.nPowTargetSpacing + rng.rand32() % params.nPowTargetSpacing - params.nPowTargetSpacing / 2;
+        blocks[i].nBits = i ? GetNextWorkRequired(&blocks[i - 1], NULL, params) : UintToArith256(params.powLimit).GetCompact();
+    }
+}
+
+// Retargets every block of a synthetic 2000 block chain with DarkGravityWave
+static void DarkGravityWaveTest(benchmark::State& state)
+{
+    Consensus::Params params;
+    std::vector<CBlockIndex> blocks(2000);
+    BuildDGWChain(blocks, params);
+
+    while (state.KeepRunning()) {
+        for (const CBlockIndex& block : blocks)
+            GetNextWorkRequired(&block, NULL, params);
+    }
+}
+
+// The retarget done for every header accepted during headers sync
+static void DarkGravityWaveHeaderTest(benchmark::State& state)
+{
+    Consensus::Params params;
+    std::vector<CBlockIndex> blocks(100);
+    BuildDGWChain(blocks, params);
+
+    while (state.KeepRunning()) {
+        GetNextWorkRequired(&blocks.back(), NULL, params);
+    }
+}
+
+// Accepts a full headers message worth of regtest headers into an empty block index
+static void ProcessNewBlockHeadersTest(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    const CChainParams& chainparams = Params();
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / strprintf("bench_adcoin_%lu_%i", (unsigned long)GetTime(), (int)(GetRand(100000)));
+    boost::filesystem::create_directories(pathTemp);
+    ForceSetArg("-datadir", pathTemp.string());
+    pblocktree = new CBlockTreeDB(1 << 20, true);
+    CCoinsViewDB* pcoinsdbview = new CCoinsViewDB(1 << 23, true);
+    pcoinsTip = new CCoinsViewCache(pcoinsdbview);
+    InitBlockIndex(chainparams);
+
+    std::vector<CBlockHeader> headers;
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = chainparams.GenesisBlock().GetHash();
+    header.nTime = chainparams.GenesisBlock().nTime;
+    header.nBits = UintToArith256(consensusParams.powLimit).GetCompact();
+    for (int i = 0; i < 2000; i++) {
+        header.nTime += consensusParams.nPowTargetSpacing;
+        header.nNonce = 0;
+        while (!CheckProofOfWork(header.GetPoWHash(), header.nBits, consensusParams))
+            header.nNonce++;
+        headers.push_back(header);
+        header.hashPrevBlock = header.GetHash();
+    }
+
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = GetNumCores();
+    while (state.KeepRunning()) {
+        UnloadBlockIndex();
+        InitBlockIndex(chainparams);
+        CValidationState validationState;
+        assert(ProcessNewBlockHeaders(headers, validationState, chainparams));
+    }
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+
+    UnloadBlockIndex();
+    delete pcoinsTip;
+    delete pcoinsdbview;
+    delete pblocktree;
+    pcoinsTip = NULL;
+    pblocktree = NULL;
+    boost::filesystem::remove_all(pathTemp);
+    SelectParams(CBaseChainParams::MAIN);
+}
+
+BENCHMARK(ScryptGenericTest);
+#if defined(USE_SSE2)
+BENCHMARK(ScryptSSE2Test);
+#endif
+BENCHMARK(ScryptMultiTest);
+BENCHMARK(ScryptPooledTest);
+BENCHMARK(ScryptMallocTest);
+BENCHMARK(ScryptMultiHugePagesTest);
+BENCHMARK(GetPoWHashTest);
+BENCHMARK(CheckProofOfWorkTest);
+BENCHMARK(DarkGravityWaveTest);
+BENCHMARK(DarkGravityWaveHeaderTest);
+BENCHMARK(ProcessNewBlockHeadersTest);
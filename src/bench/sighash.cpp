@@ -0,0 +1,68 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "primitives/transaction.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+
+#include <memory>
+
+static const unsigned int SIGHASH_INPUTS = 1000;
+
+// A transaction spending 1000 pay-to-pubkey-hash outputs, as built when
+// signing or verifying it.
+static CMutableTransaction BuildSighashTransaction(bool fWitness)
+{
+    CMutableTransaction tx;
+    tx.vin.resize(SIGHASH_INPUTS);
+    for (unsigned int i = 0; i < SIGHASH_INPUTS; i++) {
+        tx.vin[i].prevout = COutPoint(uint256(std::vector<unsigned char>(32, (unsigned char)i)), i);
+        if (fWitness) {
+            tx.vin[i].scriptWitness.stack.resize(2, std::vector<unsigned char>(72, 0));
+        } else {
+            tx.vin[i].scriptSig = CScript() << std::vector<unsigned char>(72, 0) << std::vector<unsigned char>(33, 0);
+        }
+    }
+    tx.vout.resize(2);
+    for (CTxOut& txout : tx.vout) {
+        txout.nValue = 1;
+        txout.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 0) << OP_EQUALVERIFY << OP_CHECKSIG;
+    }
+    return tx;
+}
+
+// Signature hashes of all inputs, including computing the shared data.
+static void SignatureHashAll(benchmark::State& state, bool fWitness, bool fPrecompute)
+{
+    const CTransaction tx(BuildSighashTransaction(fWitness));
+    const CScript scriptCode = tx.vout[0].scriptPubKey;
+    const SigVersion sigversion = fWitness ? SIGVERSION_WITNESS_V0 : SIGVERSION_BASE;
+    while (state.KeepRunning()) {
+        std::unique_ptr<PrecomputedTransactionData> txdata;
+        if (fPrecompute) txdata.reset(new PrecomputedTransactionData(tx));
+        for (unsigned int i = 0; i < tx.vin.size(); i++) {
+            SignatureHash(scriptCode, tx, i, SIGHASH_ALL, 1, sigversion, txdata.get());
+        }
+    }
+}
+
+static void SignatureHashLegacy(benchmark::State& state)
+{
+    SignatureHashAll(state, false, true);
+}
+
+static void SignatureHashLegacyUncached(benchmark::State& state)
+{
+    SignatureHashAll(state, false, false);
+}
+
+static void SignatureHashWitness(benchmark::State& state)
+{
+    SignatureHashAll(state, true, true);
+}
+
+BENCHMARK(SignatureHashLegacy);
+BENCHMARK(SignatureHashLegacyUncached);
+BENCHMARK(SignatureHashWitness);
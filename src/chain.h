@@ -130,7 +130,8 @@ enum BlockStatus: uint32_t {
     //! Implies all parents are also at least CHAIN.
     BLOCK_VALID_CHAIN        =    4,
 
-    //! Scripts & signatures ok. Implies all parents are also at least SCRIPTS.
+    //! Scripts & signatures ok. Implies all parents are also at least SCRIPTS, except those still
+    //! marked BLOCK_ASSUMED_VALID.
     BLOCK_VALID_SCRIPTS      =    5,
 
     //! All validity bits.
@@ -146,6 +147,10 @@ enum BlockStatus: uint32_t {
     BLOCK_FAILED_MASK        =   BLOCK_FAILED_VALID | BLOCK_FAILED_CHILD,
 
     BLOCK_OPT_WITNESS       =   128, //!< block data in blk*.data was received with a witness-enforcing client
+
+    BLOCK_HAVE_POW_HASH      =  256, //!< hashPoW holds the scrypt hash of the header (stored in the block index)
+
+    BLOCK_ASSUMED_VALID      =  512, //!< below a loaded UTXO snapshot and not yet validated in the background
 };
 
 /** The block chain is a tree shaped structure starting with the
@@ -199,6 +204,9 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    //! scrypt proof-of-work hash of the header; only valid if nStatus & BLOCK_HAVE_POW_HASH
+    uint256 hashPoW;
+
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     int32_t nSequenceId;
 
@@ -226,6 +234,7 @@ public:
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
+        hashPoW        = uint256();
     }
 
     CBlockIndex()
@@ -282,9 +291,18 @@ public:
 
     uint256 GetBlockPoWHash() const
     {
+        if (nStatus & BLOCK_HAVE_POW_HASH)
+            return hashPoW;
         return GetBlockHeader().GetPoWHash();
     }
 
+    //! Record the scrypt hash of this entry's header, so it is persisted with the block index.
+    void SetPoWHash(const uint256& hash)
+    {
+        hashPoW = hash;
+        nStatus |= BLOCK_HAVE_POW_HASH;
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -393,6 +411,10 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        // AdCoin: scrypt hash of the header, absent in entries written before it was tracked
+        if (nStatus & BLOCK_HAVE_POW_HASH)
+            READWRITE(hashPoW);
     }
 
     uint256 GetBlockHash() const
@@ -6,6 +6,8 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
 #include <vector>
 
 #include <boost/foreach.hpp>
@@ -16,21 +18,52 @@
 template <typename T>
 class CCheckQueueControl;
 
-/** 
+/**
  * Queue for verifications that have to be performed.
-  * The verifications are represented by a type T, which must provide an
-  * operator(), returning a bool.
-  *
-  * One thread (the master) is assumed to push batches of verifications
-  * onto the queue, where they are processed by N-1 worker threads. When
-  * the master is done adding work, it temporarily joins the worker pool
-  * as an N'th worker, until all jobs are done.
-  */
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done. Masters take turns through
+ * CCheckQueueControl, which holds ControlMutex for as long as it exists.
+ *
+ * Every worker has its own deque of verifications, and the master spreads
+ * the verifications it adds over them, so workers don't contend for a
+ * single lock. A worker takes batches from the back of its own deque, and
+ * when that is empty, steals from the front of the others.
+ */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
+    //! The verifications of one worker, which others may steal from.
+    struct WorkerQueue
+    {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        //! checks.size(), readable without the lock
+        std::atomic<unsigned int> nSize;
+
+        WorkerQueue() : nSize(0) {}
+    };
+
+    //! Deques of verifications. The first one is the master's; workers
+    //! beyond the number of deques share them.
+    static const int MAX_QUEUES = 65;
+    WorkerQueue queues[MAX_QUEUES];
+
+    //! The number of deques in use (the master's and one per worker).
+    std::atomic<int> nQueues;
+
+    //! The number of worker threads that have started.
+    std::atomic<int> nWorkers;
+
+    //! The deque Add() starts spreading the next verifications at
+    int nNextQueue;
+
+    //! Mutex for idle threads to block on
     boost::mutex mutex;
 
     //! Worker threads block on this when out of work
@@ -39,96 +72,123 @@ private:
     //! Master thread blocks on this when out of work
     boost::condition_variable condMaster;
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
-
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! The number of workers blocked on condWorker.
+    std::atomic<int> nIdle;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! The number of verifications in the deques.
+    std::atomic<unsigned int> nQueued;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
-     * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * This includes elements that are no longer queued, but still in a
+     * worker's own batch.
      */
-    unsigned int nTodo;
-
-    //! Whether we're shutting down.
-    bool fQuit;
+    std::atomic<unsigned int> nTodo;
 
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    /** Move up to nMax verifications from the back (own deque) or front (stolen) of q into vChecks. */
+    bool Take(WorkerQueue& q, bool fSteal, unsigned int nMax, std::vector<T>& vChecks)
+    {
+        if (q.nSize == 0)
+            return false;
+        boost::unique_lock<boost::mutex> lock(q.mutex);
+        if (q.checks.empty())
+            return false;
+        // Leave half of the deque to thieves; a thief takes half of what's left.
+        unsigned int nNow = std::max(1U, std::min(nMax, (unsigned int)(q.checks.size() + 1) / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // Swap instead of copying, to keep the lock short.
+            if (fSteal) {
+                vChecks[i].swap(q.checks.front());
+                q.checks.pop_front();
+            } else {
+                vChecks[i].swap(q.checks.back());
+                q.checks.pop_back();
+            }
+        }
+        q.nSize -= nNow;
+        nQueued -= nNow;
+        return true;
+    }
+
+    /** Get a batch of verifications, from the deque at nOwn or else from any other. */
+    bool GetBatch(int nOwn, std::vector<T>& vChecks)
+    {
+        if (nQueued == 0)
+            return false;
+        if (Take(queues[nOwn], false, nBatchSize, vChecks))
+            return true;
+        int n = nQueues;
+        for (int i = 1; i < n; i++) {
+            if (Take(queues[(nOwn + i) % n], true, nBatchSize, vChecks))
+                return true;
+        }
+        return false;
+    }
+
     /** Internal function that does bulk of the verification work. */
     bool Loop(bool fMaster = false)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
+        int nOwn = 0;
+        if (!fMaster) {
+            nOwn = 1 + nWorkers++ % (MAX_QUEUES - 1);
+            int n = nQueues;
+            while (n <= nOwn && !nQueues.compare_exchange_weak(n, nOwn + 1)) {}
+        }
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
         do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
+            if (GetBatch(nOwn, vChecks)) {
+                unsigned int nNow = vChecks.size();
+                // Check whether we need to do work at all
+                bool fOk = fAllOk;
+                BOOST_FOREACH (T& check, vChecks)
+                    if (fOk)
+                        fOk = check();
+                if (!fOk)
+                    fAllOk = false;
+                vChecks.clear();
+                if ((nTodo -= nNow) == 0) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
                 }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+                continue;
+            }
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (fMaster) {
+                while (nQueued == 0 && nTodo != 0)
+                    condMaster.wait(lock);
+                if (nTodo == 0) {
+                    bool fRet = fAllOk;
+                    // reset the status for new work later
+                    fAllOk = true;
+                    // return the current status
+                    return fRet;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
+            } else {
+                // Add() checks nIdle after increasing nQueued, so either we
+                // see its work here, or it notifies us under this lock.
+                nIdle++;
+                while (nQueued == 0)
+                    condWorker.wait(lock); // wait
+                nIdle--;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
         } while (true);
     }
 
 public:
+    //! Mutex to ensure only one concurrent CCheckQueueControl
+    boost::mutex ControlMutex;
+
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nQueues(1), nWorkers(0), nNextQueue(0), nIdle(0), nQueued(0), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn) {}
 
     //! Worker thread
     void Thread()
@@ -145,16 +205,33 @@ public:
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
-        }
+        if (vChecks.empty())
+            return;
         nTodo += vChecks.size();
-        if (vChecks.size() == 1)
-            condWorker.notify_one();
-        else if (vChecks.size() > 1)
-            condWorker.notify_all();
+        // Spread the checks over the deques in contiguous chunks, starting
+        // where the previous call stopped.
+        int n = nQueues;
+        size_t nChunk = (vChecks.size() + n - 1) / n;
+        size_t nPos = 0;
+        for (int i = nNextQueue % n; nPos < vChecks.size(); i = (i + 1) % n) {
+            size_t nEnd = std::min(vChecks.size(), nPos + nChunk);
+            boost::unique_lock<boost::mutex> lock(queues[i].mutex);
+            for (size_t j = nPos; j < nEnd; j++) {
+                queues[i].checks.push_back(T());
+                vChecks[j].swap(queues[i].checks.back());
+            }
+            queues[i].nSize += nEnd - nPos;
+            nQueued += nEnd - nPos;
+            nPos = nEnd;
+            nNextQueue = i + 1;
+        }
+        if (nIdle > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
     }
 
     ~CCheckQueue()
@@ -163,8 +240,7 @@ public:
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        return (nQueued == 0 && nTodo == 0 && fAllOk == true);
     }
 
 };
@@ -185,6 +261,7 @@ public:
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
+            pqueue->ControlMutex.lock();
             bool isIdle = pqueue->IsIdle();
             assert(isIdle);
         }
@@ -209,6 +286,8 @@ public:
     {
         if (!fDone)
             Wait();
+        if (pqueue != NULL)
+            pqueue->ControlMutex.unlock();
     }
 };
 
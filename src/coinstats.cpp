@@ -0,0 +1,149 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "coins.h"
+#include "init.h"
+#include "streams.h"
+#include "util.h"
+#include "version.h"
+
+#include <atomic>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+namespace {
+
+//! Approximate memory footprint of an unspent output: txid, index, height, amount, script length and script
+int64_t GetBogoSize(const Coin& coin)
+{
+    return 32 + 4 + 4 + 8 + 2 + coin.out.scriptPubKey.size();
+}
+
+//! The serialization each coin contributes to the set hash
+void SerializeCoin(CDataStream& ss, const COutPoint& outpoint, const Coin& coin)
+{
+    ss.clear();
+    ss << outpoint << coin;
+}
+
+//! First byte of the txids in range i
+unsigned char RangeStart(int i)
+{
+    return (unsigned char)(i * 256 / UTXO_STATS_RANGES);
+}
+
+void WalkRange(CCoinsViewCursor* pcursor, int nRange, CCoinsStats& stats, std::atomic<bool>& fFailed)
+{
+    RenameThread("bitcoin-utxowalk");
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    uint256 prevkey;
+    int nEnd = nRange + 1 < UTXO_STATS_RANGES ? RangeStart(nRange + 1) : 256;
+    for (; pcursor->Valid(); pcursor->Next()) {
+        if ((stats.utxo.nTransactionOutputs & 0xfff) == 0 && (fFailed || ShutdownRequested())) {
+            fFailed = true;
+            return;
+        }
+        COutPoint key;
+        Coin coin;
+        if (!pcursor->GetKey(key) || !pcursor->GetValue(coin)) {
+            error("%s: unable to read value", __func__);
+            fFailed = true;
+            return;
+        }
+        if (*key.hash.begin() >= nEnd)
+            break;
+        if (stats.nTransactions == 0 || key.hash != prevkey) {
+            stats.nTransactions++;
+            prevkey = key.hash;
+        }
+        stats.nSerializedSize += 32 + pcursor->GetValueSize();
+        SerializeCoin(ss, key, coin);
+        stats.utxo.muhash.Insert((const unsigned char*)ss.data(), ss.size());
+        stats.utxo.nTransactionOutputs++;
+        stats.utxo.nBogoSize += GetBogoSize(coin);
+        stats.utxo.nTotalAmount += coin.out.nValue;
+    }
+}
+
+} // anon namespace
+
+void CUTXOStats::AddCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    SerializeCoin(ss, outpoint, coin);
+    muhash.Insert((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs++;
+    nBogoSize += GetBogoSize(coin);
+    nTotalAmount += coin.out.nValue;
+}
+
+void CUTXOStats::RemoveCoin(const COutPoint& outpoint, const Coin& coin)
+{
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    SerializeCoin(ss, outpoint, coin);
+    muhash.Remove((const unsigned char*)ss.data(), ss.size());
+    nTransactionOutputs--;
+    nBogoSize -= GetBogoSize(coin);
+    nTotalAmount -= coin.out.nValue;
+}
+
+CUTXOStats& CUTXOStats::operator+=(const CUTXOStats& other)
+{
+    nTransactionOutputs += other.nTransactionOutputs;
+    nBogoSize += other.nBogoSize;
+    nTotalAmount += other.nTotalAmount;
+    muhash *= other.muhash;
+    return *this;
+}
+
+uint256 CUTXOStats::GetHash() const
+{
+    uint256 hash;
+    muhash.Finalize(hash.begin());
+    return hash;
+}
+
+void OpenUTXOStatsCursors(CCoinsView* view, std::vector<std::unique_ptr<CCoinsViewCursor> >& cursors)
+{
+    cursors.clear();
+    for (int i = 0; i < UTXO_STATS_RANGES; i++) {
+        uint256 start;
+        *start.begin() = RangeStart(i);
+        cursors.emplace_back(view->Cursor());
+        cursors.back()->Seek(COutPoint(start, 0));
+    }
+}
+
+bool ComputeUTXOStats(const std::vector<std::unique_ptr<CCoinsViewCursor> >& cursors, CCoinsStats& stats)
+{
+    assert(cursors.size() == UTXO_STATS_RANGES);
+    std::vector<CCoinsStats> vRangeStats(UTXO_STATS_RANGES);
+    std::atomic<bool> fFailed(false);
+    boost::thread_group threads;
+    for (int i = 0; i < UTXO_STATS_RANGES; i++) {
+        threads.create_thread(boost::bind(&WalkRange, cursors[i].get(), i, boost::ref(vRangeStats[i]), boost::ref(fFailed)));
+    }
+    {
+        // The walkers refer to this frame, so wait for them even if interrupted;
+        // they stop by themselves on shutdown.
+        boost::this_thread::disable_interruption di;
+        threads.join_all();
+    }
+    if (fFailed)
+        return false;
+
+    stats.utxo = CUTXOStats();
+    stats.utxo.hashBlock = cursors[0]->GetBestBlock();
+    stats.nTransactions = 0;
+    stats.nSerializedSize = 0;
+    for (const CCoinsStats& range : vRangeStats) {
+        stats.utxo += range.utxo;
+        stats.nTransactions += range.nTransactions;
+        stats.nSerializedSize += range.nSerializedSize;
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "crypto/muhash.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <memory>
+#include <vector>
+
+class CCoinsView;
+class CCoinsViewCursor;
+class COutPoint;
+class Coin;
+
+//! Number of txid ranges the UTXO set is split into when walking it in parallel
+static const int UTXO_STATS_RANGES = 16;
+
+/**
+ * Totals and a multiset hash over a set of unspent transaction outputs.
+ *
+ * All fields are additive, so the statistics of the UTXO set can be kept up
+ * to date by applying the coins created and spent by each block, and the
+ * statistics of disjoint parts of the set can be combined. The counters are
+ * signed so that an object can also hold the (possibly negative) change
+ * since some earlier state.
+ */
+class CUTXOStats
+{
+public:
+    //! The block the statistics correspond to
+    uint256 hashBlock;
+    int64_t nTransactionOutputs;
+    //! Approximate size of the set, independent of the database format
+    int64_t nBogoSize;
+    CAmount nTotalAmount;
+    MuHash3072 muhash;
+
+    CUTXOStats() : nTransactionOutputs(0), nBogoSize(0), nTotalAmount(0) {}
+
+    void AddCoin(const COutPoint& outpoint, const Coin& coin);
+    void RemoveCoin(const COutPoint& outpoint, const Coin& coin);
+
+    //! Add the statistics of a disjoint set of coins (or a change); hashBlock is left untouched.
+    CUTXOStats& operator+=(const CUTXOStats& other);
+
+    //! The hash of the set. This computes a modular inverse, which takes a few milliseconds.
+    uint256 GetHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(hashBlock);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nBogoSize);
+        READWRITE(nTotalAmount);
+        READWRITE(muhash);
+    }
+};
+
+/** Statistics gathered by a full walk over the UTXO set */
+struct CCoinsStats
+{
+    int nHeight;
+    CUTXOStats utxo;
+    uint64_t nTransactions;
+    uint64_t nSerializedSize;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nSerializedSize(0) {}
+};
+
+/**
+ * Open one cursor on view at the start of each of the UTXO_STATS_RANGES txid
+ * ranges. The cursors only see a consistent state if nothing is written to
+ * the view while they are being opened.
+ */
+void OpenUTXOStatsCursors(CCoinsView* view, std::vector<std::unique_ptr<CCoinsViewCursor> >& cursors);
+
+/**
+ * Compute the statistics of the coins visible through cursors opened with
+ * OpenUTXOStatsCursors, walking the ranges on separate threads. Returns false
+ * on read errors or if shutdown was requested. stats.nHeight is not set.
+ */
+bool ComputeUTXOStats(const std::vector<std::unique_ptr<CCoinsViewCursor> >& cursors, CCoinsStats& stats);
+
+#endif // BITCOIN_COINSTATS_H
@@ -0,0 +1,177 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+#include "crypto/sha512.h"
+
+#include <string.h>
+
+namespace
+{
+/** 2^3072 - MAX_PRIME_DIFF is the largest 3072-bit safe prime. */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+typedef Num3072::limb_t limb_t;
+typedef Num3072::double_limb_t double_limb_t;
+const int LIMB_SIZE = Num3072::LIMB_SIZE;
+const limb_t LIMB_MAX = ~(limb_t)0;
+
+/** Add x to the number in limbs[0..n), returning the carry out of the top limb. */
+limb_t AddTo(limb_t* limbs, int n, double_limb_t x)
+{
+    for (int i = 0; i < n && x; i++) {
+        x += limbs[i];
+        limbs[i] = (limb_t)x;
+        x >>= LIMB_SIZE;
+    }
+    return (limb_t)x;
+}
+} // namespace
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++) {
+        if (sizeof(limb_t) == 8) {
+            limbs[i] = ReadLE64(data + 8 * i);
+        } else {
+            limbs[i] = ReadLE32(data + 4 * i);
+        }
+    }
+    if (IsOverflow()) FullReduce();
+}
+
+void Num3072::SetToOne()
+{
+    limbs[0] = 1;
+    for (int i = 1; i < LIMBS; i++) {
+        limbs[i] = 0;
+    }
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] <= LIMB_MAX - MAX_PRIME_DIFF) return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != LIMB_MAX) return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // x - p == x + MAX_PRIME_DIFF - 2^3072; the carry out of the top limb is the 2^3072.
+    AddTo(limbs, LIMBS, MAX_PRIME_DIFF);
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook multiplication into a 6144-bit product.
+    limb_t tmp[2 * LIMBS] = {0};
+    for (int i = 0; i < LIMBS; i++) {
+        limb_t carry = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            double_limb_t cur = (double_limb_t)limbs[i] * a.limbs[j] + tmp[i + j] + carry;
+            tmp[i + j] = (limb_t)cur;
+            carry = (limb_t)(cur >> LIMB_SIZE);
+        }
+        tmp[i + LIMBS] = carry;
+    }
+
+    // Fold the upper half back in, using 2^3072 == MAX_PRIME_DIFF (mod p).
+    double_limb_t carry = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        double_limb_t cur = (double_limb_t)tmp[i + LIMBS] * MAX_PRIME_DIFF + tmp[i] + carry;
+        limbs[i] = (limb_t)cur;
+        carry = cur >> LIMB_SIZE;
+    }
+    // The remaining carry is below 2^21, so folding it in overflows at most once more,
+    // and after that the low limbs are small enough that the final fold cannot.
+    carry = AddTo(limbs, LIMBS, carry * MAX_PRIME_DIFF);
+    if (carry) AddTo(limbs, LIMBS, carry * MAX_PRIME_DIFF);
+    if (IsOverflow()) FullReduce();
+}
+
+Num3072 Num3072::GetInverse() const
+{
+    // Fermat's little theorem: a^-1 == a^(p-2) (mod p). The exponent p - 2 has
+    // all bits above its lowest limb set, and LIMB_MAX - MAX_PRIME_DIFF - 1 as that limb.
+    const limb_t low = LIMB_MAX - MAX_PRIME_DIFF - 1;
+    Num3072 result;
+    for (int bit = LIMB_SIZE * LIMBS - 1; bit >= 0; bit--) {
+        result.Multiply(result);
+        if (bit >= LIMB_SIZE || ((low >> bit) & 1)) {
+            result.Multiply(*this);
+        }
+    }
+    return result;
+}
+
+void Num3072::Divide(const Num3072& a)
+{
+    Multiply(a.GetInverse());
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; i++) {
+        if (sizeof(limb_t) == 8) {
+            WriteLE64(out + 8 * i, limbs[i]);
+        } else {
+            WriteLE32(out + 4 * i, limbs[i]);
+        }
+    }
+}
+
+namespace
+{
+/** Map a byte string to a pseudorandom element of the group. */
+Num3072 ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char seed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(seed);
+    unsigned char expanded[Num3072::BYTE_SIZE];
+    for (unsigned char i = 0; i < Num3072::BYTE_SIZE / CSHA512::OUTPUT_SIZE; i++) {
+        CSHA512().Write(seed, sizeof(seed)).Write(&i, 1).Finalize(expanded + i * CSHA512::OUTPUT_SIZE);
+    }
+    return Num3072(expanded);
+}
+} // namespace
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& mul)
+{
+    numerator.Multiply(mul.numerator);
+    denominator.Multiply(mul.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& div)
+{
+    numerator.Multiply(div.denominator);
+    denominator.Multiply(div.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE]) const
+{
+    Num3072 result = numerator;
+    result.Divide(denominator);
+    unsigned char data[Num3072::BYTE_SIZE];
+    result.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
@@ -0,0 +1,95 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** An integer modulo the prime 2^3072 - 1103717, stored as little-endian limbs. */
+class Num3072
+{
+public:
+#ifdef __SIZEOF_INT128__
+    typedef uint64_t limb_t;
+    typedef unsigned __int128 double_limb_t;
+#else
+    typedef uint32_t limb_t;
+    typedef uint64_t double_limb_t;
+#endif
+    static const int LIMB_SIZE = 8 * sizeof(limb_t);
+    static const size_t BYTE_SIZE = 384;
+    static const int LIMBS = 3072 / LIMB_SIZE;
+
+    limb_t limbs[LIMBS];
+
+    Num3072() { SetToOne(); }
+    //! Construct from 384 little-endian bytes, reducing modulo the prime.
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void SetToOne();
+    void Multiply(const Num3072& a);
+    //! Multiply by the modular inverse of a.
+    void Divide(const Num3072& a);
+    Num3072 GetInverse() const;
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/** A multiset hash over arbitrary byte strings.
+ *
+ *  Each element is mapped to a number modulo a 3072-bit prime, and the set is
+ *  represented by the product of its elements. Adding and removing elements
+ *  are therefore order-independent, and the hashes of two disjoint sets can
+ *  be combined by multiplying them. Removals are accumulated in a separate
+ *  denominator, so that the (expensive) modular inverse is only computed
+ *  when the final hash is requested.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+
+    //! Construct the hash of the empty set.
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    //! Add all elements of another set (which must be disjoint from this one).
+    MuHash3072& operator*=(const MuHash3072& mul);
+    //! Remove all elements of another set (which must be a subset of this one).
+    MuHash3072& operator/=(const MuHash3072& div);
+
+    //! Compute the 256-bit hash of the set. The object remains untouched.
+    void Finalize(unsigned char hash[OUTPUT_SIZE]) const;
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        unsigned char data[2 * Num3072::BYTE_SIZE];
+        numerator.ToBytes(data);
+        denominator.ToBytes(data + Num3072::BYTE_SIZE);
+        s.write((const char*)data, sizeof(data));
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s)
+    {
+        unsigned char data[2 * Num3072::BYTE_SIZE];
+        s.read((char*)data, sizeof(data));
+        numerator = Num3072(data);
+        denominator = Num3072(data + Num3072::BYTE_SIZE);
+    }
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
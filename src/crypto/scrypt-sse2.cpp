@@ -34,6 +34,9 @@
 #include <openssl/sha.h>
 
 #include <emmintrin.h>
+#if defined(ENABLE_AVX2)
+#include <immintrin.h>
+#endif
 
 static inline void xor_salsa8_sse2(__m128i B[4], const __m128i Bx[4])
 {
@@ -134,3 +137,152 @@ void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchp
 
 	PBKDF2_SHA256((const uint8_t *)input, 80, B, 128, 1, (uint8_t *)output, 32);
 }
+
+/*
+ * Multi-lane kernels: N independent hashes are interleaved word by word, so
+ * that word k of every lane shares one vector and Salsa20/8 runs on all
+ * lanes with plain vertical SIMD operations. Only the data-dependent reads
+ * of V in the second loop differ between lanes.
+ */
+
+/* One double round of Salsa20/8 in terms of R(a, b, c, s): x[a] ^= ROTL(x[b] + x[c], s) */
+#define SALSA8_DOUBLEROUND(R) do { \
+	/* Operate on columns. */ \
+	R( 4,  0, 12,  7);  R( 9,  5,  1,  7);  R(14, 10,  6,  7);  R( 3, 15, 11,  7); \
+	R( 8,  4,  0,  9);  R(13,  9,  5,  9);  R( 2, 14, 10,  9);  R( 7,  3, 15,  9); \
+	R(12,  8,  4, 13);  R( 1, 13,  9, 13);  R( 6,  2, 14, 13);  R(11,  7,  3, 13); \
+	R( 0, 12,  8, 18);  R( 5,  1, 13, 18);  R(10,  6,  2, 18);  R(15, 11,  7, 18); \
+	/* Operate on rows. */ \
+	R( 1,  0,  3,  7);  R( 6,  5,  4,  7);  R(11, 10,  9,  7);  R(12, 15, 14,  7); \
+	R( 2,  1,  0,  9);  R( 7,  6,  5,  9);  R( 8, 11, 10,  9);  R(13, 12, 15,  9); \
+	R( 3,  2,  1, 13);  R( 4,  7,  6, 13);  R( 9,  8, 11, 13);  R(14, 13, 12, 13); \
+	R( 0,  3,  2, 18);  R( 5,  4,  7, 18);  R(10,  9,  8, 18);  R(15, 14, 13, 18); \
+} while (0)
+
+#define R_4WAY(a, b, c, s) do { \
+	__m128i T = _mm_add_epi32(x[b], x[c]); \
+	x[a] = _mm_xor_si128(x[a], _mm_or_si128(_mm_slli_epi32(T, s), _mm_srli_epi32(T, 32 - (s)))); \
+} while (0)
+
+static inline void xor_salsa8_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm_xor_si128(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2)
+		SALSA8_DOUBLEROUND(R_4WAY);
+	for (i = 0; i < 16; i++)
+		B[i] = _mm_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[4][128];
+	union {
+		__m128i i128[32];
+		uint32_t u32[32 * 4];
+	} X;
+	uint32_t *V;
+	uint32_t i, k;
+	int n;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (n = 0; n < 4; n++)
+		PBKDF2_SHA256((const uint8_t *)&input[n * 80], 80, (const uint8_t *)&input[n * 80], 80, 1, B[n], 128);
+
+	for (k = 0; k < 32; k++)
+		for (n = 0; n < 4; n++)
+			X.u32[k * 4 + n] = le32dec(&B[n][k * 4]);
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			_mm_store_si128((__m128i *)&V[(i * 32 + k) * 4], X.i128[k]);
+		xor_salsa8_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_4way(&X.i128[16], &X.i128[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		for (n = 0; n < 4; n++) {
+			const uint32_t *Vn = &V[(X.u32[16 * 4 + n] & 1023) * 32 * 4 + n];
+			for (k = 0; k < 32; k++)
+				X.u32[k * 4 + n] ^= Vn[k * 4];
+		}
+		xor_salsa8_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_4way(&X.i128[16], &X.i128[0]);
+	}
+
+	for (n = 0; n < 4; n++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[n][k * 4], X.u32[k * 4 + n]);
+		PBKDF2_SHA256((const uint8_t *)&input[n * 80], 80, B[n], 128, 1, (uint8_t *)&output[n * 32], 32);
+	}
+}
+
+#if defined(ENABLE_AVX2)
+#define R_8WAY(a, b, c, s) do { \
+	__m256i T = _mm256_add_epi32(x[b], x[c]); \
+	x[a] = _mm256_xor_si256(x[a], _mm256_or_si256(_mm256_slli_epi32(T, s), _mm256_srli_epi32(T, 32 - (s)))); \
+} while (0)
+
+__attribute__((target("avx2")))
+static inline void xor_salsa8_8way(__m256i B[16], const __m256i Bx[16])
+{
+	__m256i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm256_xor_si256(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2)
+		SALSA8_DOUBLEROUND(R_8WAY);
+	for (i = 0; i < 16; i++)
+		B[i] = _mm256_add_epi32(B[i], x[i]);
+}
+
+__attribute__((target("avx2")))
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[8][128];
+	union {
+		__m256i i256[32];
+		uint32_t u32[32 * 8];
+	} X;
+	uint32_t *V;
+	uint32_t i, k;
+	int n;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (n = 0; n < 8; n++)
+		PBKDF2_SHA256((const uint8_t *)&input[n * 80], 80, (const uint8_t *)&input[n * 80], 80, 1, B[n], 128);
+
+	for (k = 0; k < 32; k++)
+		for (n = 0; n < 8; n++)
+			X.u32[k * 8 + n] = le32dec(&B[n][k * 4]);
+
+	for (i = 0; i < 1024; i++) {
+		for (k = 0; k < 32; k++)
+			_mm256_store_si256((__m256i *)&V[(i * 32 + k) * 8], X.i256[k]);
+		xor_salsa8_8way(&X.i256[0], &X.i256[16]);
+		xor_salsa8_8way(&X.i256[16], &X.i256[0]);
+	}
+
+	/* Gather lane n's word k of V[j_n] with a single instruction per word. */
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i mask = _mm256_set1_epi32(1023);
+	for (i = 0; i < 1024; i++) {
+		__m256i idx = _mm256_add_epi32(_mm256_slli_epi32(_mm256_and_si256(X.i256[16], mask), 8), lanes);
+		for (k = 0; k < 32; k++)
+			X.i256[k] = _mm256_xor_si256(X.i256[k], _mm256_i32gather_epi32((const int *)&V[k * 8], idx, 4));
+		xor_salsa8_8way(&X.i256[0], &X.i256[16]);
+		xor_salsa8_8way(&X.i256[16], &X.i256[0]);
+	}
+
+	for (n = 0; n < 8; n++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[n][k * 4], X.u32[k * 8 + n]);
+		PBKDF2_SHA256((const uint8_t *)&input[n * 80], 80, B[n], 128, 1, (uint8_t *)&output[n * 32], 32);
+	}
+}
+#endif
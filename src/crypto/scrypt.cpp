@@ -31,10 +31,14 @@
 //#include "util.h"
 #include <stdlib.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <openssl/sha.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif
 
-#if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
+#if defined(USE_SSE2) && (!defined(USE_SSE2_ALWAYS) || defined(ENABLE_AVX2))
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
 #include <intrin.h>
@@ -290,10 +294,36 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 // By default, set to generic scrypt function. This will prevent crash in case when scrypt_detect_sse2() wasn't called
 void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad) = &scrypt_1024_1_1_256_sp_generic;
 
+// Widest multi-lane kernel; stays unused (1 way) until scrypt_detect_sse2() was called
+static void (*scrypt_1024_1_1_256_sp_multi)(const char *input, char *output, char *scratchpad) = NULL;
+static int scrypt_multi_ways = 1;
+
+#if defined(ENABLE_AVX2)
+static bool scrypt_detect_avx2()
+{
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+    // The OS has to save the ymm registers on context switches (OSXSAVE, and XCR0 bits 1 and 2)
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return false;
+    uint32_t xcr0, xcr0_hi;
+    __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+    if ((xcr0 & 6) != 6)
+        return false;
+    if (__get_cpuid_max(0, NULL) < 7)
+        return false;
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & bit_AVX2) != 0;
+}
+#endif
+
 void scrypt_detect_sse2()
 {
 #if defined(USE_SSE2_ALWAYS)
     printf("scrypt: using scrypt-sse2 as built.\n");
+    scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_sse2_4way;
+    scrypt_multi_ways = 4;
 #else // USE_SSE2_ALWAYS
     // 32bit x86 Linux or Windows, detect cpuid features
     unsigned int cpuid_edx=0;
@@ -311,19 +341,143 @@ void scrypt_detect_sse2()
     if (cpuid_edx & 1<<26)
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_sse2;
+        scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_sse2_4way;
+        scrypt_multi_ways = 4;
         printf("scrypt: using scrypt-sse2 as detected.\n");
     }
     else
     {
         scrypt_1024_1_1_256_sp_detected = &scrypt_1024_1_1_256_sp_generic;
         printf("scrypt: using scrypt-generic, SSE2 unavailable.\n");
+        return;
     }
 #endif // USE_SSE2_ALWAYS
+
+#if defined(ENABLE_AVX2)
+    if (scrypt_detect_avx2()) {
+        scrypt_1024_1_1_256_sp_multi = &scrypt_1024_1_1_256_sp_avx2_8way;
+        scrypt_multi_ways = 8;
+    }
+#endif
+    printf("scrypt: hashing up to %d inputs at once.\n", scrypt_multi_ways);
+}
+#endif
+
+static bool scrypt_huge_pages = DEFAULT_SCRYPT_HUGE_PAGES;
+static const size_t SCRYPT_PAGE_SIZE = 4096;
+static const size_t SCRYPT_HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+void scrypt_set_huge_pages(bool fHugePages)
+{
+	scrypt_huge_pages = fHugePages;
 }
+
+/*
+ * Scratchpads are page aligned, so the 64-byte alignment the kernels do
+ * themselves is a no-op and size bytes are all they need. With huge pages
+ * they are rounded up to whole huge pages, so that the kernel can back them
+ * with as few TLB entries as possible.
+ */
+struct scrypt_scratchpad {
+	char *ptr;
+	size_t size;
+	bool huge;
+
+	scrypt_scratchpad() : ptr(NULL), size(0), huge(false) {}
+	~scrypt_scratchpad() { release(); }
+
+	char *get(size_t nSize)
+	{
+		if (ptr && size >= nSize && huge == scrypt_huge_pages)
+			return ptr;
+		release();
+		huge = scrypt_huge_pages;
+		size_t align = huge ? SCRYPT_HUGE_PAGE_SIZE : SCRYPT_PAGE_SIZE;
+		size = (nSize + align - 1) & ~(align - 1);
+#ifdef WIN32
+		ptr = (char *)_aligned_malloc(size, align);
+#else
+		void *p;
+		ptr = posix_memalign(&p, align, size) == 0 ? (char *)p : NULL;
+#ifdef MADV_HUGEPAGE
+		if (ptr && huge)
+			madvise(ptr, size, MADV_HUGEPAGE);
+#endif
+#endif
+		return ptr;
+	}
+
+	void release()
+	{
+#ifdef WIN32
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+		ptr = NULL;
+		size = 0;
+	}
+};
+
+#if defined(HAVE_THREAD_LOCAL)
+/* Every thread reuses one scratchpad, grown to the widest kernel it has run */
+static thread_local scrypt_scratchpad scrypt_thread_scratchpad;
 #endif
 
 void scrypt_1024_1_1_256(const char *input, char *output)
 {
-	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
-    scrypt_1024_1_1_256_sp(input, output, scratchpad);
+#if defined(HAVE_THREAD_LOCAL)
+	char *scratchpad = scrypt_thread_scratchpad.get(SCRYPT_SCRATCHPAD_SIZE - 63);
+	if (scratchpad) {
+		scrypt_1024_1_1_256_sp(input, output, scratchpad);
+		return;
+	}
+#endif
+	char stack_scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+	scrypt_1024_1_1_256_sp(input, output, stack_scratchpad);
+}
+
+int scrypt_best_ways()
+{
+#if defined(USE_SSE2)
+	return scrypt_multi_ways;
+#else
+	return 1;
+#endif
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, int n)
+{
+#if defined(USE_SSE2)
+	if (n > 1 && scrypt_multi_ways > 1) {
+#if defined(HAVE_THREAD_LOCAL)
+		char *scratchpad = scrypt_thread_scratchpad.get((SCRYPT_SCRATCHPAD_SIZE - 63) * scrypt_multi_ways);
+#else
+		scrypt_scratchpad call_scratchpad;
+		char *scratchpad = call_scratchpad.get((SCRYPT_SCRATCHPAD_SIZE - 63) * scrypt_multi_ways);
+#endif
+		if (scratchpad) {
+			for (; n >= scrypt_multi_ways; n -= scrypt_multi_ways) {
+				scrypt_1024_1_1_256_sp_multi(input, output, scratchpad);
+				input += 80 * scrypt_multi_ways;
+				output += 32 * scrypt_multi_ways;
+			}
+			/* Hash what is left 4 at a time, padding a short last batch with copies of its last input. */
+			while (n > 1) {
+				char padin[80 * 4], padout[32 * 4];
+				int m = n < 4 ? n : 4;
+				memcpy(padin, input, 80 * m);
+				for (int i = m; i < 4; i++)
+					memcpy(&padin[80 * i], &input[80 * (m - 1)], 80);
+				scrypt_1024_1_1_256_sp_sse2_4way(padin, padout, scratchpad);
+				memcpy(output, padout, 32 * m);
+				input += 80 * m;
+				output += 32 * m;
+				n -= m;
+			}
+		}
+	}
+#endif
+	for (; n > 0; n--, input += 80, output += 32)
+		scrypt_1024_1_1_256(input, output);
 }
@@ -1,13 +1,40 @@
 #ifndef SCRYPT_H
 #define SCRYPT_H
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
 #include <stdlib.h>
 #include <stdint.h>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
+/** Maximum number of inputs the multi-lane kernels hash at once */
+static const int SCRYPT_MAX_WAYS = 8;
+
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/**
+ * Hash n independent 80-byte inputs, laid out back to back, into n 32-byte
+ * outputs. Uses the widest multi-lane kernel picked by scrypt_detect_sse2(),
+ * so callers with several headers at hand should batch them through here.
+ */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, int n);
+
+/** Number of inputs the selected multi-lane kernel hashes at once (1 if none) */
+int scrypt_best_ways();
+
+static const bool DEFAULT_SCRYPT_HUGE_PAGES = false;
+
+/**
+ * Ask for the scratchpads of scrypt_1024_1_1_256 and scrypt_1024_1_1_256_multi
+ * to be backed by transparent huge pages, where the OS supports them. Each
+ * thread keeps its scratchpad between calls, so this costs up to 2 MiB of
+ * memory per hashing thread.
+ */
+void scrypt_set_huge_pages(bool fHugePages);
+
 #if defined(USE_SSE2)
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
 #define USE_SSE2_ALWAYS 1
@@ -18,6 +45,12 @@ void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scrat
 
 void scrypt_detect_sse2();
 void scrypt_1024_1_1_256_sp_sse2(const char *input, char *output, char *scratchpad);
+/** Hash 4 inputs at once; scratchpad must hold 4 * (SCRYPT_SCRATCHPAD_SIZE - 63) + 63 bytes */
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad);
+#if defined(ENABLE_AVX2)
+/** Hash 8 inputs at once; scratchpad must hold 8 * (SCRYPT_SCRATCHPAD_SIZE - 63) + 63 bytes. Requires AVX2. */
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad);
+#endif
 extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output, char *scratchpad);
 #else
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
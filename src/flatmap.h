@@ -0,0 +1,344 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_FLATMAP_H
+#define BITCOIN_FLATMAP_H
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/** Hash map with open addressing and arena-allocated entries, meant for very
+ * large maps such as the coins cache.
+ *
+ * The table is a flat array of (hash, entry pointer) slots probed linearly,
+ * so a lookup touches one or two cache lines instead of walking a bucket list,
+ * and the full hash stored in each slot avoids most key comparisons and all
+ * rehashing of keys when the table grows. Entries are constructed in chunks
+ * of an arena owned by the map rather than in one heap node each; erased ones
+ * are recycled, compact() gives back what a map that shrank no longer needs,
+ * and clear() releases everything at once.
+ *
+ * As with a node-based map, entries never move: references to them stay valid
+ * until they are erased. Iterators are invalidated by insertion (which may
+ * grow the table) but not by erasing other elements, so `erase(it++)` loops
+ * work.
+ *
+ * Keys are compared with Equal, so that a map keyed by pointers can compare
+ * what they point to (see indirectmap).
+ */
+template <typename K, typename T, typename Hash, typename Equal = std::equal_to<K> >
+class flatmap
+{
+public:
+    typedef K key_type;
+    typedef T mapped_type;
+    typedef std::pair<const K, T> value_type;
+    typedef size_t size_type;
+
+private:
+    struct slot {
+        //! Hash of the key while the slot is in use, otherwise EMPTY or ERASED
+        size_t hash;
+        value_type* entry;
+    };
+    enum { EMPTY = 0, ERASED = 1 };
+
+    //! Arena storage for one entry; the first word links free cells together
+    union cell {
+        typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type data;
+        cell* next;
+    };
+    //! Chunks double in size up to a limit, so that small maps stay small
+    enum { FIRST_CHUNK_CELLS = 4, MAX_CHUNK_CELLS = 4096 };
+
+    std::vector<slot> table;
+    size_type nSize;
+    size_type nErased;
+    //! Arena chunks and the number of cells in each
+    std::vector<std::pair<cell*, size_t> > chunks;
+    cell* freeCells;
+    size_t nChunkUnused;
+    Hash hasher;
+    Equal equal;
+
+    static size_t ChunkCells(size_t i) { return i < 10 ? (size_t)FIRST_CHUNK_CELLS << i : (size_t)MAX_CHUNK_CELLS; }
+
+    cell* AllocateCell()
+    {
+        if (freeCells) {
+            cell* c = freeCells;
+            freeCells = c->next;
+            return c;
+        }
+        if (nChunkUnused == 0) {
+            size_t nCells = ChunkCells(chunks.size());
+            cell* chunk = static_cast<cell*>(malloc(nCells * sizeof(cell)));
+            if (!chunk) throw std::bad_alloc();
+            chunks.push_back(std::make_pair(chunk, nCells));
+            nChunkUnused = nCells;
+        }
+        return chunks.back().first + chunks.back().second - nChunkUnused--;
+    }
+
+    void FreeCell(cell* c)
+    {
+        c->next = freeCells;
+        freeCells = c;
+    }
+
+    //! Slot holding key, or NULL. The table must not be empty.
+    slot* Lookup(const K& key, size_t hash) const
+    {
+        size_t mask = table.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            const slot& s = table[i];
+            if (s.entry) {
+                if (s.hash == hash && equal(s.entry->first, key)) return const_cast<slot*>(&s);
+            } else if (s.hash == EMPTY) {
+                return NULL;
+            }
+        }
+    }
+
+    //! First free slot for hash in slots. The table must have room.
+    static slot* FreeSlot(std::vector<slot>& slots, size_t hash)
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+            if (!slots[i].entry) return &slots[i];
+        }
+    }
+
+    slot* FreeSlot(size_t hash) { return FreeSlot(table, hash); }
+
+    //! Smallest table that keeps the load of nEntries under 1/2
+    static size_t TableSlots(size_t nEntries)
+    {
+        size_t nSlots = 8;
+        while (nEntries * 2 > nSlots) nSlots *= 2;
+        return nSlots;
+    }
+
+    void Rehash(size_t nSlots)
+    {
+        std::vector<slot> old(nSlots, slot{EMPTY, NULL});
+        old.swap(table);
+        nErased = 0;
+        for (const slot& s : old) {
+            if (s.entry) *FreeSlot(s.hash) = s;
+        }
+    }
+
+    //! Make room for one more entry, keeping the load (including erased slots) under 3/4
+    void Reserve()
+    {
+        if ((nSize + nErased + 1) * 4 <= table.size() * 3) return;
+        size_t nSlots = std::max(table.size(), (size_t)8);
+        while ((nSize + 1) * 2 > nSlots) nSlots *= 2;
+        Rehash(nSlots);
+    }
+
+    template <typename P>
+    slot* Insert(size_t hash, P&& value)
+    {
+        Reserve();
+        slot* s = FreeSlot(hash);
+        cell* c = AllocateCell();
+        try {
+            s->entry = new (&c->data) value_type(std::forward<P>(value));
+        } catch (...) {
+            FreeCell(c);
+            throw;
+        }
+        if (s->hash == ERASED) nErased--;
+        s->hash = hash;
+        nSize++;
+        return s;
+    }
+
+    flatmap(const flatmap&);
+    flatmap& operator=(const flatmap&);
+
+public:
+    template <bool is_const>
+    class iter
+    {
+        friend class flatmap;
+        typedef typename std::conditional<is_const, const slot*, slot*>::type slot_ptr;
+        slot_ptr pos;
+        slot_ptr last;
+
+        void Skip() { while (pos != last && !pos->entry) ++pos; }
+
+    public:
+        typedef typename std::conditional<is_const, const value_type, value_type>::type entry_type;
+
+        iter() : pos(NULL), last(NULL) {}
+        iter(slot_ptr posIn, slot_ptr lastIn) : pos(posIn), last(lastIn) { Skip(); }
+        iter(const iter<false>& it) : pos(it.pos), last(it.last) {}
+
+        entry_type& operator*() const { return *pos->entry; }
+        entry_type* operator->() const { return pos->entry; }
+        iter& operator++() { ++pos; Skip(); return *this; }
+        iter operator++(int) { iter copy(*this); ++(*this); return copy; }
+        bool operator==(const iter& other) const { return pos == other.pos; }
+        bool operator!=(const iter& other) const { return pos != other.pos; }
+
+        friend class iter<true>;
+    };
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    flatmap() : nSize(0), nErased(0), freeCells(NULL), nChunkUnused(0) {}
+    ~flatmap() { clear(); }
+
+    iterator begin() { return iterator(table.data(), table.data() + table.size()); }
+    iterator end() { return iterator(table.data() + table.size(), table.data() + table.size()); }
+    const_iterator begin() const { return const_iterator(table.data(), table.data() + table.size()); }
+    const_iterator end() const { return const_iterator(table.data() + table.size(), table.data() + table.size()); }
+
+    size_type size() const { return nSize; }
+    bool empty() const { return nSize == 0; }
+
+    iterator find(const K& key)
+    {
+        if (nSize == 0) return end();
+        slot* s = Lookup(key, hasher(key));
+        return s ? iterator(s, table.data() + table.size()) : end();
+    }
+
+    const_iterator find(const K& key) const
+    {
+        if (nSize == 0) return end();
+        const slot* s = Lookup(key, hasher(key));
+        return s ? const_iterator(s, table.data() + table.size()) : end();
+    }
+
+    size_type count(const K& key) const { return find(key) != end(); }
+
+    //! Insert value unless its key is present already; value is only consumed if inserted.
+    template <typename P>
+    std::pair<iterator, bool> insert(P&& value)
+    {
+        size_t hash = hasher(value.first);
+        if (nSize != 0) {
+            slot* s = Lookup(value.first, hash);
+            if (s) return std::make_pair(iterator(s, table.data() + table.size()), false);
+        }
+        slot* s = Insert(hash, std::forward<P>(value));
+        return std::make_pair(iterator(s, table.data() + table.size()), true);
+    }
+
+    T& operator[](const K& key) { return insert(value_type(key, T())).first->second; }
+
+    void erase(iterator it)
+    {
+        slot* s = it.pos;
+        assert(s->entry);
+        s->entry->~value_type();
+        FreeCell(reinterpret_cast<cell*>(s->entry));
+        s->entry = NULL;
+        s->hash = ERASED;
+        nSize--;
+        nErased++;
+    }
+
+    size_type erase(const K& key)
+    {
+        iterator it = find(key);
+        if (it == end()) return 0;
+        erase(it);
+        return 1;
+    }
+
+    //! Destroy all entries and release the table and the arena.
+    void clear()
+    {
+        if (!std::is_trivially_destructible<value_type>::value) {
+            for (const slot& s : table) {
+                if (s.entry) s.entry->~value_type();
+            }
+        }
+        std::vector<slot>().swap(table);
+        for (const auto& chunk : chunks) free(chunk.first);
+        std::vector<std::pair<cell*, size_t> >().swap(chunks);
+        freeCells = NULL;
+        nChunkUnused = 0;
+        nSize = 0;
+        nErased = 0;
+    }
+
+    /** Move the entries into a single chunk and a table sized for the current
+     * contents, if less than half of the arena cells or a quarter of the table
+     * slots are in use. erase() keeps both for the next insertions to reuse;
+     * this gives the memory back once a map has shrunk for good. Unlike
+     * erase(), it invalidates all references and iterators. Returns whether
+     * the map was rebuilt.
+     */
+    bool compact()
+    {
+        size_t nCells = 0;
+        for (const auto& chunk : chunks) nCells += chunk.second;
+        if (nSize * 2 >= nCells && (table.size() <= 8 || nSize * 4 >= table.size())) return false;
+        if (nSize == 0) {
+            clear();
+            return true;
+        }
+
+        std::vector<slot> fresh(TableSlots(nSize), slot{EMPTY, NULL});
+        cell* chunk = static_cast<cell*>(malloc(nSize * sizeof(cell)));
+        if (!chunk) throw std::bad_alloc();
+        size_t nMoved = 0;
+        try {
+            for (const slot& s : table) {
+                if (!s.entry) continue;
+                slot* dest = FreeSlot(fresh, s.hash);
+                dest->entry = new (&chunk[nMoved].data) value_type(std::move(*s.entry));
+                dest->hash = s.hash;
+                nMoved++;
+            }
+        } catch (...) {
+            // Leave the map as it was
+            for (size_t i = 0; i < nMoved; i++) {
+                reinterpret_cast<value_type*>(&chunk[i].data)->~value_type();
+            }
+            free(chunk);
+            throw;
+        }
+
+        size_t nEntries = nSize;
+        clear();
+        table.swap(fresh);
+        chunks.push_back(std::make_pair(chunk, nEntries));
+        nSize = nEntries;
+        return true;
+    }
+
+    //! Exchange contents, including the hasher the stored hashes were computed with.
+    void swap(flatmap& other)
+    {
+        table.swap(other.table);
+        std::swap(nSize, other.nSize);
+        std::swap(nErased, other.nErased);
+        chunks.swap(other.chunks);
+        std::swap(freeCells, other.freeCells);
+        std::swap(nChunkUnused, other.nChunkUnused);
+        std::swap(hasher, other.hasher);
+    }
+
+    // Memory accounting, see memusage::DynamicUsage
+    size_t table_bytes() const { return table.capacity() * sizeof(slot); }
+    size_t chunk_count() const { return chunks.size(); }
+    size_t chunk_bytes(size_t i) const { return chunks[i].second * sizeof(cell); }
+    static size_t entry_bytes() { return sizeof(cell) + 2 * sizeof(slot); }
+};
+
+#endif // BITCOIN_FLATMAP_H
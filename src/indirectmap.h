@@ -5,23 +5,34 @@
 #ifndef BITCOIN_INDIRECTMAP_H
 #define BITCOIN_INDIRECTMAP_H
 
+#include "flatmap.h"
+
+#include <stddef.h>
+
+template <class Hash>
+struct DereferencingHasher {
+    Hash hasher;
+    template <class T> size_t operator()(const T* a) const { return hasher(*a); }
+};
+
 template <class T>
-struct DereferencingComparator { bool operator()(const T a, const T b) const { return *a < *b; } };
+struct DereferencingEqual { bool operator()(const T a, const T b) const { return *a == *b; } };
 
-/* Map whose keys are pointers, but are compared by their dereferenced values.
+/* Hash map whose keys are pointers, but are hashed and compared by their
+ * dereferenced values.
  *
- * Differs from a plain std::map<const K*, T, DereferencingComparator<K*> > in
- * that methods that take a key for comparison take a K rather than taking a K*
+ * Differs from a plain flatmap<const K*, T, DereferencingHasher<Hash>, DereferencingEqual<const K*> >
+ * in that methods that take a key for lookup take a K rather than taking a K*
  * (taking a K* would be confusing, since it's the value rather than the address
- * of the object for comparison that matters due to the dereferencing comparator).
+ * of the object that matters due to the dereferencing hasher).
  *
- * Objects pointed to by keys must not be modified in any way that changes the
- * result of DereferencingComparator.
+ * Objects pointed to by keys must not be modified in any way that changes
+ * their hash or the result of DereferencingEqual.
  */
-template <class K, class T>
+template <class K, class T, class Hash>
 class indirectmap {
 private:
-    typedef std::map<const K*, T, DereferencingComparator<const K*> > base;
+    typedef flatmap<const K*, T, DereferencingHasher<Hash>, DereferencingEqual<const K*> > base;
     base m;
 public:
     typedef typename base::iterator iterator;
@@ -35,22 +46,23 @@ public:
     // pass address (value interface)
     iterator find(const K& key)                     { return m.find(&key); }
     const_iterator find(const K& key) const         { return m.find(&key); }
-    iterator lower_bound(const K& key)              { return m.lower_bound(&key); }
-    const_iterator lower_bound(const K& key) const  { return m.lower_bound(&key); }
     size_type erase(const K& key)                   { return m.erase(&key); }
     size_type count(const K& key) const             { return m.count(&key); }
 
     // passthrough
     bool empty() const              { return m.empty(); }
     size_type size() const          { return m.size(); }
-    size_type max_size() const      { return m.max_size(); }
     void clear()                    { m.clear(); }
+    bool compact()                  { return m.compact(); }
     iterator begin()                { return m.begin(); }
     iterator end()                  { return m.end(); }
     const_iterator begin() const    { return m.begin(); }
     const_iterator end() const      { return m.end(); }
-    const_iterator cbegin() const   { return m.cbegin(); }
-    const_iterator cend() const     { return m.cend(); }
+    const_iterator cbegin() const   { return m.begin(); }
+    const_iterator cend() const     { return m.end(); }
+
+    // Memory accounting, see memusage::DynamicUsage
+    const base& base_map() const    { return m; }
 };
 
 #endif // BITCOIN_INDIRECTMAP_H
@@ -16,6 +16,7 @@
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "httpserver.h"
 #include "httprpc.h"
 #include "key.h"
@@ -148,9 +149,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -207,6 +208,8 @@ void Shutdown()
     UnregisterValidationInterface(peerLogic.get());
     peerLogic.reset();
     g_connman.reset();
+    UnregisterValidationInterface(g_blocktemplatebuilder.get());
+    g_blocktemplatebuilder.reset();
 
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
@@ -229,8 +232,11 @@ void Shutdown()
         if (pcoinsTip != NULL) {
             FlushStateToDisk();
         }
+        UnloadSnapshotValidation();
         delete pcoinsTip;
         pcoinsTip = NULL;
+        delete pcoinsWriteBehind;
+        pcoinsWriteBehind = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
         delete pcoinsdbview;
@@ -324,6 +330,7 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-?", _("Print this help message and exit"));
     strUsage += HelpMessageOpt("-version", _("Print version and exit"));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
+    strUsage += HelpMessageOpt("-backgroundflush", strprintf(_("Write the chainstate to disk on a background thread while validation continues; may use up to twice -dbcache memory (default: %u)"), DEFAULT_BACKGROUND_FLUSH));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to operate in a blocks only mode (default: %u)"), DEFAULT_BLOCKSONLY));
@@ -337,9 +344,11 @@ std::string HelpMessage(HelpMessageMode mode)
     }
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dbcachekeep=<n>", strprintf(_("Keep up to this percentage of the database cache loaded with recently used coins after writing it to disk (0 to 100, default: %d)"), nDefaultDbCacheKeep));
     if (showDebug)
         strUsage += HelpMessageOpt("-feefilter", strprintf("Tell other nodes to filter invs to us by our mempool min fee (default: %u)", DEFAULT_FEEFILTER));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
+    strUsage += HelpMessageOpt("-loadsnapshot=<file>", _("Bootstrap an empty chain state from a UTXO snapshot written by dumptxoutset. The blocks below the snapshot are validated against it in the background and then pruned, so this requires -prune and -snapshothash"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
     strUsage += HelpMessageOpt("-maxmempool=<n>", strprintf(_("Keep the transaction memory pool below <n> megabytes (default: %u)"), DEFAULT_MAX_MEMPOOL_SIZE));
     strUsage += HelpMessageOpt("-mempoolexpiry=<n>", strprintf(_("Do not keep transactions in the mempool longer than <n> hours (default: %u)"), DEFAULT_MEMPOOL_EXPIRY));
@@ -354,6 +363,9 @@ std::string HelpMessage(HelpMessageMode mode)
             "(default: 0 = disable pruning blocks, 1 = allow manual pruning via RPC, >%u = automatically prune block files to stay under the specified target size in MiB)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
+    if (showDebug)
+        strUsage += HelpMessageOpt("-scrypthugepages", strprintf("Back the per-thread scrypt scratchpads with transparent huge pages where supported (default: %u)", DEFAULT_SCRYPT_HUGE_PAGES));
+    strUsage += HelpMessageOpt("-snapshothash=<hex>", _("Content hash the UTXO snapshot given with -loadsnapshot must have, as reported by dumptxoutset on a trusted node"));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
@@ -421,6 +433,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
         strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
         strUsage += HelpMessageOpt("-checkblockindex", strprintf("Do a full consistency check for mapBlockIndex, setBlockIndexCandidates, chainActive and mapBlocksUnlinked occasionally. Also sets -checkmempool (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
+        strUsage += HelpMessageOpt("-checkblockreadpow", strprintf("Check the proof of work of every block read from disk, instead of trusting the hash stored in the block index (default: %u)", DEFAULT_CHECK_BLOCK_READ_POW));
         strUsage += HelpMessageOpt("-checkmempool=<n>", strprintf("Run checks every <n> transactions (default: %u)", Params(CBaseChainParams::MAIN).DefaultConsistencyChecks()));
         strUsage += HelpMessageOpt("-checkpoints", strprintf("Disable expensive verification for known chain history (default: %u)", DEFAULT_CHECKPOINTS_ENABLED));
         strUsage += HelpMessageOpt("-disablesafemode", strprintf("Disable safemode, override a real safe mode event (default: %u)", DEFAULT_DISABLE_SAFEMODE));
@@ -482,8 +495,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-blockmaxsize=<n>", strprintf(_("Set maximum block size in bytes (default: %d)"), DEFAULT_BLOCK_MAX_SIZE));
     strUsage += HelpMessageOpt("-blockprioritysize=<n>", strprintf(_("Set maximum size of high-priority/low-fee transactions in bytes (default: %d)"), DEFAULT_BLOCK_PRIORITY_SIZE));
     strUsage += HelpMessageOpt("-blockmintxfee=<amt>", strprintf(_("Set lowest fee rate (in %s/kB) for transactions to be included in block creation. (default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_MIN_TX_FEE)));
+    strUsage += HelpMessageOpt("-blocklongpollfee=<amt>", strprintf(_("Answer getblocktemplate long polls once the template's fees have grown by this amount (in %s, 0 = any, default: %s)"), CURRENCY_UNIT, FormatMoney(DEFAULT_BLOCK_LONGPOLL_FEE)));
     if (showDebug)
         strUsage += HelpMessageOpt("-blockversion=<n>", "Override block version to test forking scenarios");
+    strUsage += HelpMessageOpt("-genthreads=<n>", strprintf(_("Set the number of threads searching for a block in the generate RPCs (0 = one per core, default: %d)"), DEFAULT_GENERATE_THREADS));
 
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
@@ -938,6 +953,7 @@ bool AppInitParameterInteraction()
     }
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
+    fCheckBlockReadPoW = GetBoolArg("-checkblockreadpow", DEFAULT_CHECK_BLOCK_READ_POW);
 
     hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
     if (!hashAssumeValid.IsNull())
@@ -986,6 +1002,15 @@ bool AppInitParameterInteraction()
         LogPrintf("Prune configured to target %uMiB on disk for block and undo files.\n", nPruneTarget / 1024 / 1024);
         fPruneMode = true;
     }
+    if (IsArgSet("-loadsnapshot")) {
+        if (!fPruneMode)
+            return InitError(_("Loading a UTXO snapshot requires -prune."));
+        std::string strSnapshotHash = GetArg("-snapshothash", "");
+        if (strSnapshotHash.size() != 64 || !IsHex(strSnapshotHash))
+            return InitError(_("Loading a UTXO snapshot requires its content hash, given with -snapshothash."));
+        if (GetBoolArg("-reindex", false))
+            return InitError(_("Loading a UTXO snapshot is incompatible with -reindex."));
+    }
 
     RegisterAllCoreRPCCommands(tableRPC);
 #ifdef ENABLE_WALLET
@@ -1023,6 +1048,12 @@ bool AppInitParameterInteraction()
         if (!ParseMoney(GetArg("-blockmintxfee", ""), n))
             return InitError(AmountErrMsg("blockmintxfee", GetArg("-blockmintxfee", "")));
     }
+    if (IsArgSet("-blocklongpollfee"))
+    {
+        CAmount n = 0;
+        if (!ParseMoney(GetArg("-blocklongpollfee", ""), n))
+            return InitError(AmountErrMsg("blocklongpollfee", GetArg("-blocklongpollfee", "")));
+    }
 
     // Feerate used to define dust.  Shouldn't be changed lightly as old
     // implementations may inadvertently create non-standard transactions
@@ -1184,6 +1215,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (nScriptCheckThreads) {
         for (int i=0; i<nScriptCheckThreads-1; i++)
             threadGroup.create_thread(&ThreadScriptCheck);
+        for (int i=0; i<nScriptCheckThreads-1; i++)
+            threadGroup.create_thread(&ThreadPrefetchInputs);
     }
 
     // Start the lightweight task scheduler thread
@@ -1207,6 +1240,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 #if defined(USE_SSE2)
     scrypt_detect_sse2();
 #endif
+    scrypt_set_huge_pages(GetBoolArg("-scrypthugepages", DEFAULT_SCRYPT_HUGE_PAGES));
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
@@ -1225,6 +1259,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     peerLogic.reset(new PeerLogicValidation(&connman));
     RegisterValidationInterface(peerLogic.get());
+    g_blocktemplatebuilder.reset(new CBlockTemplateBuilder(chainparams));
+    RegisterValidationInterface(g_blocktemplatebuilder.get());
     RegisterNodeSignals(GetNodeSignals());
 
     // sanitize comments per BIP-0014, format user agent and check total size
@@ -1429,6 +1465,8 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsWriteBehind;
+                pcoinsWriteBehind = NULL;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
@@ -1436,7 +1474,18 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
                 pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
-                pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                if (GetBoolArg("-backgroundflush", DEFAULT_BACKGROUND_FLUSH)) {
+                    pcoinsWriteBehind = new CCoinsViewWriteBehind(pcoinscatcher);
+                    pcoinsTip = new CCoinsViewCache(pcoinsWriteBehind);
+                } else {
+                    pcoinsTip = new CCoinsViewCache(pcoinscatcher);
+                }
+
+                // If necessary, upgrade from older database format.
+                if (!pcoinsdbview->Upgrade()) {
+                    strLoadError = _("Error upgrading chainstate database");
+                    break;
+                }
 
                 if (fReindex) {
                     pblocktree->WriteReindexing(true);
@@ -1467,6 +1516,22 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
+                // Check for an interrupted -loadsnapshot, which leaves coins without a best block behind.
+                // The headers it accepted stay in the block index, so only -reindex (which wipes the
+                // flag with it) can start over; the blocks are then downloaded from the genesis block.
+                bool fLoadingSnapshot = false;
+                pblocktree->ReadFlag("loadingsnapshot", fLoadingSnapshot);
+                if (fLoadingSnapshot) {
+                    strLoadError = _("Loading a UTXO snapshot was interrupted. You need to rebuild the database using -reindex, without -loadsnapshot, which downloads the entire blockchain");
+                    break;
+                }
+
+                // Resume validating the blocks below a previously loaded UTXO snapshot
+                if (!LoadSnapshotValidation()) {
+                    strLoadError = _("Error opening the UTXO snapshot validation database");
+                    break;
+                }
+
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1544,6 +1609,22 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
+    if (IsArgSet("-loadsnapshot")) {
+        uiInterface.InitMessage(_("Loading UTXO snapshot..."));
+        if (!LoadSnapshot(GetArg("-loadsnapshot", ""), uint256S(GetArg("-snapshothash", "")), chainparams))
+            return InitError(_("Unable to load the UTXO snapshot. See debug.log for details."));
+    }
+    {
+        LOCK(cs_main);
+        if (pindexSnapshotBase)
+            threadGroup.create_thread(&ThreadValidateSnapshot);
+    }
+
+    // The UTXO set statistics are maintained as blocks are connected; if they
+    // weren't saved with the current chain state, rebuild them in the background.
+    if (!LoadUTXOStats())
+        threadGroup.create_thread(&ThreadRebuildUTXOStats);
+
     boost::filesystem::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
     CAutoFile est_filein(fopen(est_path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
     // Allowed to fail as this file IS missing on first startup.
@@ -1608,6 +1689,7 @@ bool AppInitMain(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
     threadGroup.create_thread(boost::bind(&ThreadImport, vImportFiles));
+    threadGroup.create_thread(&ThreadBackfillBlockIndexPoW);
 
     // Wait for genesis block to be processed
     {
@@ -5,7 +5,9 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "flatmap.h"
 #include "indirectmap.h"
+#include "prevector.h"
 
 #include <stdlib.h>
 
@@ -117,18 +119,39 @@ static inline size_t IncrementalDynamicUsage(const std::map<X, Y, Z>& m)
     return MallocUsage(sizeof(stl_tree_node<std::pair<const X, Y> >));
 }
 
-// indirectmap has underlying map with pointer as key
+// flatmap has a slot table plus the arena chunks holding its entries
 
-template<typename X, typename Y>
-static inline size_t DynamicUsage(const indirectmap<X, Y>& m)
+template<typename X, typename Y, typename Z, typename W>
+static inline size_t DynamicUsage(const flatmap<X, Y, Z, W>& m)
 {
-    return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >)) * m.size();
+    size_t usage = MallocUsage(m.table_bytes());
+    for (size_t i = 0; i < m.chunk_count(); i++)
+        usage += MallocUsage(m.chunk_bytes(i));
+    return usage;
 }
 
-template<typename X, typename Y>
-static inline size_t IncrementalDynamicUsage(const indirectmap<X, Y>& m)
+// Usage of a flatmap's entries alone: a cell and the two table slots each
+// one gets after a compact(). Meant for owners that compact the map whenever
+// it shrinks, where the cells kept for reuse are bounded by that.
+
+template<typename X, typename Y, typename Z, typename W>
+static inline size_t LiveDynamicUsage(const flatmap<X, Y, Z, W>& m)
+{
+    return m.size() * m.entry_bytes();
+}
+
+// indirectmap has an underlying flatmap with pointer as key
+
+template<typename X, typename Y, typename Z>
+static inline size_t DynamicUsage(const indirectmap<X, Y, Z>& m)
+{
+    return DynamicUsage(m.base_map());
+}
+
+template<typename X, typename Y, typename Z>
+static inline size_t LiveDynamicUsage(const indirectmap<X, Y, Z>& m)
 {
-    return MallocUsage(sizeof(stl_tree_node<std::pair<const X*, Y> >));
+    return LiveDynamicUsage(m.base_map());
 }
 
 template<typename X>
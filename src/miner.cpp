@@ -27,6 +27,8 @@
 #include "validationinterface.h"
 
 #include <algorithm>
+#include <atomic>
+#include <boost/bind.hpp>
 #include <boost/thread.hpp>
 #include <boost/tuple/tuple.hpp>
 #include <queue>
@@ -214,6 +216,55 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     return std::move(pblocktemplate);
 }
 
+int BlockAssembler::AppendToBlock(std::unique_ptr<CBlockTemplate>& blocktemplate, const std::vector<CTxMemPool::txiter>& vNew)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+    if (vNew.empty())
+        return 0;
+    int64_t nTimeStart = GetTimeMicros();
+
+    pblocktemplate = std::move(blocktemplate);
+    pblock = &pblocktemplate->block;
+    uint64_t nBlockTxBefore = nBlockTx;
+
+    BOOST_FOREACH(CTxMemPool::txiter iter, vNew) {
+        // Appending keeps the block in a valid order as long as every
+        // unconfirmed parent is already in it.
+        if (inBlock.count(iter) || isStillDependent(iter))
+            continue;
+        if (iter->GetModifiedFee() < blockMinFeeRate.GetFee(iter->GetTxSize()))
+            continue;
+        CTxMemPool::setEntries package;
+        package.insert(iter);
+        if (!TestPackage(iter->GetTxSize(), iter->GetSigOpCost()) || !TestPackageTransactions(package))
+            continue;
+        AddToBlock(iter);
+    }
+
+    int nAppended = nBlockTx - nBlockTxBefore;
+    if (nAppended > 0) {
+        nLastBlockTx = nBlockTx;
+        nLastBlockSize = nBlockSize;
+        nLastBlockWeight = nBlockWeight;
+
+        // Pay the new fees in the coinbase and recommit to the new witnesses
+        const CBlockIndex* pindexPrev = chainActive.Tip();
+        assert(pblock->hashPrevBlock == pindexPrev->GetBlockHash());
+        CMutableTransaction coinbaseTx(*pblock->vtx[0]);
+        coinbaseTx.vout.resize(1);
+        coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+        pblock->vtx[0] = MakeTransactionRef(std::move(coinbaseTx));
+        pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+        pblocktemplate->vTxFees[0] = -nFees;
+    }
+
+    LogPrint("bench", "AppendToBlock(): %d of %u txs appended, %u txs fees: %ld: %.2fms\n", nAppended, vNew.size(), nBlockTx, nFees, 0.001 * (GetTimeMicros() - nTimeStart));
+
+    blocktemplate = std::move(pblocktemplate);
+    return nAppended;
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
@@ -645,3 +696,194 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
 }
+
+/** A range of nonces of one block template, searched by one or more threads */
+struct NonceSearch
+{
+    CBlockHeader header;
+    uint32_t nNonces;
+    std::atomic<uint32_t> nNext;
+    //! Offset of the lowest solution found so far, or nNonces if there is none
+    std::atomic<uint32_t> nFound;
+    std::atomic<uint64_t> nHashes;
+
+    NonceSearch(const CBlockHeader& headerIn, uint32_t nNoncesIn) : header(headerIn), nNonces(nNoncesIn), nNext(0), nFound(nNoncesIn), nHashes(0) {}
+};
+
+/**
+ * Claim batches of nonces from the search until a solution is found or the range
+ * is exhausted. Batches below a solution found by another thread are still
+ * searched, so the lowest solution wins no matter how many threads take part.
+ */
+static void SearchNoncesThread(NonceSearch& search, const Consensus::Params& params)
+{
+    const uint32_t nWays = scrypt_best_ways();
+    CBlockHeader headers[SCRYPT_MAX_WAYS];
+    uint256 hashes[SCRYPT_MAX_WAYS];
+    while (true) {
+        uint32_t nStart = search.nNext.fetch_add(nWays);
+        if (nStart >= search.nFound)
+            break;
+        uint32_t nBatch = std::min(nWays, search.nNonces - nStart);
+        for (uint32_t i = 0; i < nBatch; i++) {
+            headers[i] = search.header;
+            headers[i].nNonce += nStart + i;
+        }
+        ComputePoWHashes(headers, hashes, nBatch);
+        search.nHashes += nBatch;
+        for (uint32_t i = 0; i < nBatch; i++) {
+            if (CheckProofOfWork(hashes[i], search.header.nBits, params)) {
+                uint32_t nFound = search.nFound;
+                while (nStart + i < nFound && !search.nFound.compare_exchange_weak(nFound, nStart + i));
+                break;
+            }
+        }
+    }
+}
+
+uint32_t SearchNonces(const CBlockHeader& header, uint32_t nNonces, int nThreads, const Consensus::Params& params, uint64_t& nHashes)
+{
+    NonceSearch search(header, nNonces);
+    if (nThreads > 1) {
+        boost::thread_group threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.create_thread(boost::bind(&SearchNoncesThread, boost::ref(search), boost::cref(params)));
+        threads.join_all();
+    } else {
+        SearchNoncesThread(search, params);
+    }
+    nHashes += search.nHashes;
+    return search.nFound;
+}
+
+std::unique_ptr<CBlockTemplateBuilder> g_blocktemplatebuilder;
+
+CBlockTemplateBuilder::CBlockTemplateBuilder(const CChainParams& chainparams)
+    : assembler(chainparams), pindexPrev(NULL), fMineWitnessTx(false), fMissedTxs(false), nLastBuild(0), fStale(false), nChanges(0), nFeesAdded(0)
+{
+    mempool.NotifyEntryAdded.connect(boost::bind(&CBlockTemplateBuilder::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.connect(boost::bind(&CBlockTemplateBuilder::TransactionRemoved, this, _1, _2));
+}
+
+CBlockTemplateBuilder::~CBlockTemplateBuilder()
+{
+    mempool.NotifyEntryAdded.disconnect(boost::bind(&CBlockTemplateBuilder::TransactionAdded, this, _1));
+    mempool.NotifyEntryRemoved.disconnect(boost::bind(&CBlockTemplateBuilder::TransactionRemoved, this, _1, _2));
+}
+
+void CBlockTemplateBuilder::NotifyChange()
+{
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        ++nChanges;
+    }
+    cvBlockChange.notify_all();
+}
+
+void CBlockTemplateBuilder::TransactionAdded(const CTxMemPoolEntry& entry)
+{
+    {
+        LOCK(cs);
+        // Without a template that can still be extended, the next call assembles a new block anyway
+        if (pblocktemplate && !fStale)
+            vAdded.push_back(entry.GetTx().GetHash());
+    }
+    // Transactions without fees can't make a waiter's template grow
+    CAmount nFees = entry.GetModifiedFee();
+    if (nFees <= 0)
+        return;
+    {
+        boost::unique_lock<boost::mutex> lock(csBestBlock);
+        nFeesAdded += nFees;
+    }
+    cvBlockChange.notify_all();
+}
+
+void CBlockTemplateBuilder::TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason)
+{
+    {
+        LOCK(cs);
+        // Transactions outside the template can leave without affecting it
+        if (!setInTemplate.count(tx->GetHash()))
+            return;
+        fStale = true;
+        vAdded.clear();
+    }
+    NotifyChange();
+}
+
+void CBlockTemplateBuilder::UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload)
+{
+    {
+        LOCK(cs);
+        fStale = true;
+        vAdded.clear();
+    }
+    NotifyChange();
+}
+
+unsigned int CBlockTemplateBuilder::GetChanges(CAmount& nFeesAddedOut)
+{
+    boost::unique_lock<boost::mutex> lock(csBestBlock);
+    nFeesAddedOut = nFeesAdded;
+    return nChanges;
+}
+
+bool CBlockTemplateBuilder::WaitForChange(unsigned int nChangesSeen, CAmount nFeesAddedTarget, const boost::system_time& deadline)
+{
+    boost::unique_lock<boost::mutex> lock(csBestBlock);
+    // cvBlockChange also wakes us for other blocks and smaller additions, which are waited out here
+    while (nChanges == nChangesSeen && nFeesAdded < nFeesAddedTarget) {
+        if (!cvBlockChange.timed_wait(lock, deadline))
+            return nChanges != nChangesSeen || nFeesAdded >= nFeesAddedTarget;
+    }
+    return true;
+}
+
+CBlockTemplate* CBlockTemplateBuilder::GetTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTxIn)
+{
+    AssertLockHeld(cs_main);
+    LOCK2(mempool.cs, cs);
+
+    std::vector<uint256> vNew;
+    vNew.swap(vAdded);
+
+    if (pblocktemplate && !fStale && pindexPrev == chainActive.Tip() &&
+        scriptPubKey == scriptPubKeyIn && fMineWitnessTx == fMineWitnessTxIn)
+    {
+        std::vector<CTxMemPool::txiter> vIters;
+        vIters.reserve(vNew.size());
+        BOOST_FOREACH(const uint256& hash, vNew) {
+            CTxMemPool::txiter it = mempool.mapTx.find(hash);
+            if (it != mempool.mapTx.end())
+                vIters.push_back(it);
+        }
+        int nAppended = assembler.AppendToBlock(pblocktemplate, vIters);
+        const std::vector<CTransactionRef>& vtx = pblocktemplate->block.vtx;
+        for (size_t i = vtx.size() - nAppended; i < vtx.size(); i++)
+            setInTemplate.insert(vtx[i]->GetHash());
+        if (nAppended < (int)vIters.size())
+            fMissedTxs = true;
+
+        if (!fMissedTxs || GetTime() - nLastBuild <= BLOCK_TEMPLATE_REBUILD_INTERVAL)
+            return pblocktemplate.get();
+    }
+
+    // Clear the template so future calls make a new block, despite any failures from here on
+    pblocktemplate.reset();
+    setInTemplate.clear();
+    fStale = false;
+    fMissedTxs = false;
+
+    const CBlockIndex* pindexPrevNew = chainActive.Tip();
+    nLastBuild = GetTime();
+    pblocktemplate = assembler.CreateNewBlock(scriptPubKeyIn, fMineWitnessTxIn);
+    if (!pblocktemplate)
+        return NULL;
+    BOOST_FOREACH(const CTransactionRef& tx, pblocktemplate->block.vtx)
+        setInTemplate.insert(tx->GetHash());
+    pindexPrev = pindexPrevNew;
+    scriptPubKey = scriptPubKeyIn;
+    fMineWitnessTx = fMineWitnessTxIn;
+    return pblocktemplate.get();
+}
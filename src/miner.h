@@ -7,7 +7,9 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
 #include <stdint.h>
 #include <memory>
@@ -23,6 +25,12 @@ class CWallet;
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Default for -genthreads, the number of threads searching nonces in the generate RPCs */
+static const int DEFAULT_GENERATE_THREADS = 1;
+/** Default for -blocklongpollfee, the fee growth that answers a getblocktemplate long poll (0 = any) */
+static const CAmount DEFAULT_BLOCK_LONGPOLL_FEE = 0;
+/** Seconds a block template is kept when new transactions could not be appended to it */
+static const int64_t BLOCK_TEMPLATE_REBUILD_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -166,6 +174,10 @@ public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     std::unique_ptr<CBlockTemplate> CreateNewBlock(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+    /** Append transactions that entered the mempool after CreateNewBlock to
+      * the template it returned, skipping those that do not fit or still have
+      * unconfirmed parents outside the block. Returns the number appended. */
+    int AppendToBlock(std::unique_ptr<CBlockTemplate>& blocktemplate, const std::vector<CTxMemPool::txiter>& vNew);
 
 private:
     // utility functions
@@ -209,8 +221,76 @@ private:
     int UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * Keeps a block template for the current tip up to date with the mempool, so
+ * that getblocktemplate does not have to assemble a new block on every call.
+ *
+ * The template is assembled from scratch only when the tip changes, when one
+ * of its transactions leaves the mempool, or when new transactions could not
+ * be appended to it and it is older than BLOCK_TEMPLATE_REBUILD_INTERVAL.
+ * Otherwise transactions that entered the mempool since the last call are
+ * appended in arrival order, which only looks at those transactions.
+ */
+class CBlockTemplateBuilder : public CValidationInterface
+{
+private:
+    BlockAssembler assembler;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    const CBlockIndex* pindexPrev;
+    CScript scriptPubKey;
+    bool fMineWitnessTx;
+    // Whether some transactions were left out since the last full assembly
+    bool fMissedTxs;
+    int64_t nLastBuild;
+
+    // Mempool changes not yet applied to the template, only recorded while it
+    // can still be extended. cs also guards pblocktemplate against these callbacks.
+    CCriticalSection cs;
+    std::vector<uint256> vAdded;
+    std::set<uint256> setInTemplate;
+    bool fStale;
+
+    // Protected by csBestBlock, so that waiters can tell whether the template
+    // may have grown enough without taking cs_main: nChanges is bumped when a
+    // new tip or a removal invalidates the template, and nFeesAdded totals
+    // the (modified) fees of every transaction added to the mempool.
+    unsigned int nChanges;
+    CAmount nFeesAdded;
+
+    void TransactionAdded(const CTxMemPoolEntry& entry);
+    void TransactionRemoved(CTransactionRef tx, MemPoolRemovalReason reason);
+    void NotifyChange();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindexNew, const CBlockIndex *pindexFork, bool fInitialDownload) override;
+
+public:
+    CBlockTemplateBuilder(const CChainParams& chainparams);
+    ~CBlockTemplateBuilder();
+
+    /** Return a template on top of the current tip with coinbase to
+      * scriptPubKeyIn. It stays valid and unchanged while cs_main is held. */
+    CBlockTemplate* GetTemplate(const CScript& scriptPubKeyIn, bool fMineWitnessTx=true);
+    /** Return a counter that changes whenever the template has to be rebuilt,
+      * and set nFeesAddedOut to the fees added to the mempool so far */
+    unsigned int GetChanges(CAmount& nFeesAddedOut);
+    /** Wait until the counter moves on from nChangesSeen, until the fees added
+      * to the mempool reach nFeesAddedTarget, or until deadline.
+      * May return early; returns false only on timeout. */
+    bool WaitForChange(unsigned int nChangesSeen, CAmount nFeesAddedTarget, const boost::system_time& deadline);
+};
+
+/** The template builder used by getblocktemplate */
+extern std::unique_ptr<CBlockTemplateBuilder> g_blocktemplatebuilder;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
+/**
+ * Search nNonces nonces of header, starting at its nNonce, on nThreads threads.
+ * Returns the offset of the lowest nonce that meets the header's target, or nNonces
+ * if there is none, and adds the number of hashes computed to nHashes.
+ */
+uint32_t SearchNonces(const CBlockHeader& header, uint32_t nNonces, int nThreads, const Consensus::Params& params, uint64_t& nHashes);
 
 #endif // BITCOIN_MINER_H
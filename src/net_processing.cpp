@@ -554,6 +554,36 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<con
     }
 }
 
+/** Add up to count blocks below a loaded UTXO snapshot that its validation needs next and nodeid can provide. */
+void FindSnapshotBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<const CBlockIndex*>& vBlocks, const Consensus::Params& consensusParams) {
+    if (count == 0 || pindexSnapshotBase == NULL)
+        return;
+
+    CNodeState *state = State(nodeid);
+    assert(state != NULL);
+    if (state->pindexBestKnownBlock == NULL || state->pindexBestKnownBlock->GetAncestor(pindexSnapshotBase->nHeight) != pindexSnapshotBase)
+        return;
+
+    // Blocks the validation has yet to read are not pruned, so stay within
+    // BLOCK_DOWNLOAD_WINDOW of it.
+    int nMaxHeight = std::min<int>(pindexSnapshotBase->nHeight, pindexSnapshotValidated->nHeight + BLOCK_DOWNLOAD_WINDOW);
+    std::vector<const CBlockIndex*> vToFetch;
+    for (const CBlockIndex* pindex = pindexSnapshotBase->GetAncestor(nMaxHeight); pindex != pindexSnapshotValidated; pindex = pindex->pprev)
+        vToFetch.push_back(pindex);
+    unsigned int nAdded = 0;
+    BOOST_REVERSE_FOREACH(const CBlockIndex* pindex, vToFetch) {
+        if (!state->fHaveWitness && IsWitnessEnabled(pindex->pprev, consensusParams)) {
+            // We wouldn't download this block or its descendants from this peer.
+            return;
+        }
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) && mapBlocksInFlight.count(pindex->GetBlockHash()) == 0) {
+            vBlocks.push_back(pindex);
+            if (++nAdded == count)
+                return;
+        }
+    }
+}
+
 } // anon namespace
 
 bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
@@ -904,12 +934,15 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
                 recentRejects->reset();
             }
 
-            // Use pcoinsTip->HaveCoinsInCache as a quick approximation to exclude
-            // requesting or processing some txs which have already been included in a block
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included in a block.
+            // The outputs are keyed individually, so we look for the first two: a
+            // transaction usually has at least one of them still unspent.
             return recentRejects->contains(inv.hash) ||
                    mempool.exists(inv.hash) ||
                    mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoinsInCache(inv.hash);
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 0)) || // Best effort: only try output 0 and 1
+                   pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, 1));
         }
     case MSG_BLOCK:
     case MSG_WITNESS_BLOCK:
@@ -1786,6 +1819,16 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
         CInv inv(MSG_TX, tx.GetHash());
         pfrom->AddInventoryKnown(inv);
 
+        // Verify the scripts on the script check threads before taking
+        // cs_main, so that AcceptToMemoryPool finds the signatures cached
+        bool fAlreadyHave;
+        {
+            LOCK(cs_main);
+            fAlreadyHave = AlreadyHave(inv);
+        }
+        if (!fAlreadyHave)
+            PrevalidateTransactions(mempool, std::vector<CTransactionRef>(1, ptx));
+
         LOCK(cs_main);
 
         bool fMissingInputs = false;
@@ -1810,6 +1853,33 @@ bool static ProcessMessage(CNode* pfrom, const std::string& strCommand, CDataStr
                 tx.GetHash().ToString(),
                 mempool.size(), mempool.DynamicMemoryUsage() / 1000);
 
+            // Verify the scripts of the orphans this one completes together,
+            // before they are accepted one by one below
+            std::vector<CTransactionRef> vOrphans;
+            std::set<uint256> setOrphansSeen;
+            std::deque<COutPoint> vPrevalidateQueue(vWorkQueue);
+            while (!vPrevalidateQueue.empty()) {
+                auto itByPrev = mapOrphanTransactionsByPrev.find(vPrevalidateQueue.front());
+                vPrevalidateQueue.pop_front();
+                if (itByPrev == mapOrphanTransactionsByPrev.end())
+                    continue;
+                for (auto mi = itByPrev->second.begin(); mi != itByPrev->second.end(); ++mi) {
+                    const CTransactionRef& porphanTx = (*mi)->second.tx;
+                    if (!setOrphansSeen.insert(porphanTx->GetHash()).second)
+                        continue;
+                    vOrphans.push_back(porphanTx);
+                    for (unsigned int i = 0; i < porphanTx->vout.size(); i++) {
+                        vPrevalidateQueue.emplace_back(porphanTx->GetHash(), i);
+                    }
+                }
+            }
+            if (!vOrphans.empty()) {
+                // The loop below looks the orphans up again, so they may change meanwhile
+                LEAVE_CRITICAL_SECTION(cs_main);
+                PrevalidateTransactions(mempool, vOrphans);
+                ENTER_CRITICAL_SECTION(cs_main);
+            }
+
             // Recursively process any orphan transactions that depended on this one
             std::set<NodeId> setMisbehaving;
             while (!vWorkQueue.empty()) {
@@ -3197,6 +3267,7 @@ bool SendMessages(CNode* pto, CConnman& connman, const std::atomic<bool>& interr
             std::vector<const CBlockIndex*> vToDownload;
             NodeId staller = -1;
             FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller, consensusParams);
+            FindSnapshotBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight - vToDownload.size(), vToDownload, consensusParams);
             BOOST_FOREACH(const CBlockIndex *pindex, vToDownload) {
                 uint32_t nFetchFlags = GetFetchFlags(pto, pindex->pprev, consensusParams);
                 vGetData.push_back(CInv(MSG_BLOCK | nFetchFlags, pindex->GetBlockHash()));
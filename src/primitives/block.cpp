@@ -23,6 +23,23 @@ uint256 CBlockHeader::GetPoWHash() const
     return thash;
 }
 
+void ComputePoWHashes(const CBlockHeader* pheaders, uint256* phashes, size_t n)
+{
+    char input[80 * SCRYPT_MAX_WAYS];
+    char output[32 * SCRYPT_MAX_WAYS];
+    while (n > 0) {
+        size_t nBatch = std::min(n, (size_t)SCRYPT_MAX_WAYS);
+        for (size_t i = 0; i < nBatch; i++)
+            memcpy(&input[80 * i], BEGIN(pheaders[i].nVersion), 80);
+        scrypt_1024_1_1_256_multi(input, output, nBatch);
+        for (size_t i = 0; i < nBatch; i++)
+            memcpy(BEGIN(phashes[i]), &output[32 * i], 32);
+        pheaders += nBatch;
+        phashes += nBatch;
+        n -= nBatch;
+    }
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
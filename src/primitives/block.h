@@ -121,6 +121,9 @@ public:
     std::string ToString() const;
 };
 
+/** Compute the scrypt hashes of n headers, hashing as many at once as the detected scrypt kernel allows. */
+void ComputePoWHashes(const CBlockHeader* pheaders, uint256* phashes, size_t n);
+
 /** Describes a place in the block chain to another node such that if the
  * other node doesn't have the same branch, it can find a recent common trunk.
  * The further back it is, the further before the fork it may be.
@@ -11,6 +11,7 @@
 #include "consensus/params.h"
 #include "consensus/validation.h"
 #include "core_io.h"
+#include "crypto/scrypt.h"
 #include "init.h"
 #include "validation.h"
 #include "miner.h"
@@ -19,9 +20,11 @@
 #include "rpc/server.h"
 #include "txmempool.h"
 #include "util.h"
+#include "utilmoneystr.h"
 #include "utilstrencodings.h"
 #include "validationinterface.h"
 
+#include <atomic>
 #include <memory>
 #include <stdint.h>
 
@@ -96,6 +99,9 @@ UniValue getnetworkhashps(const JSONRPCRequest& request)
     return GetNetworkHashPS(request.params.size() > 0 ? request.params[0].get_int() : 120, request.params.size() > 1 ? request.params[1].get_int() : -1);
 }
 
+/** Hash rate of the last generate call, reported by getmininginfo */
+static std::atomic<double> dHashesPerSec(0);
+
 UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nGenerate, uint64_t nMaxTries, bool keepScript)
 {
     static const int nInnerLoopCount = 0x10000;
@@ -109,6 +115,11 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
         nHeight = nHeightStart;
         nHeightEnd = nHeightStart+nGenerate;
     }
+    int nThreads = GetArg("-genthreads", DEFAULT_GENERATE_THREADS);
+    if (nThreads <= 0)
+        nThreads = GetNumCores();
+    uint64_t nHashes = 0;
+    int64_t nTimeStart = GetTimeMicros();
     unsigned int nExtraNonce = 0;
     UniValue blockHashes(UniValue::VARR);
     while (nHeight < nHeightEnd)
@@ -121,10 +132,9 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
             LOCK(cs_main);
             IncrementExtraNonce(pblock, chainActive.Tip(), nExtraNonce);
         }
-        while (nMaxTries > 0 && pblock->nNonce < nInnerLoopCount && !CheckProofOfWork(pblock->GetPoWHash(), pblock->nBits, Params().GetConsensus())) {
-            ++pblock->nNonce;
-            --nMaxTries;
-        }
+        uint32_t nFound = SearchNonces(pblock->GetBlockHeader(), std::min<uint64_t>(nMaxTries, nInnerLoopCount - pblock->nNonce), nThreads, Params().GetConsensus(), nHashes);
+        pblock->nNonce += nFound;
+        nMaxTries -= nFound;
         if (nMaxTries == 0) {
             break;
         }
@@ -143,6 +153,11 @@ UniValue generateBlocks(boost::shared_ptr<CReserveScript> coinbaseScript, int nG
             coinbaseScript->KeepScript();
         }
     }
+    int64_t nTimeElapsed = GetTimeMicros() - nTimeStart;
+    if (nTimeElapsed > 0)
+        dHashesPerSec = nHashes * 1000000.0 / nTimeElapsed;
+    LogPrintf("%s: generated %d blocks, %u hashes in %.3fs (%.1f hashes/s, %d threads)\n", __func__,
+        nHeight - nHeightStart, nHashes, nTimeElapsed * 0.000001, dHashesPerSec.load(), nThreads);
     return blockHashes;
 }
 
@@ -230,6 +245,7 @@ UniValue getmininginfo(const JSONRPCRequest& request)
             "  \"difficulty\": xxx.xxxxx    (numeric) The current difficulty\n"
             "  \"errors\": \"...\"            (string) Current errors\n"
             "  \"networkhashps\": nnn,      (numeric) The network hashes per second\n"
+            "  \"hashespersec\": nnn,       (numeric) The hashes per second of the last generate call\n"
             "  \"pooledtx\": n              (numeric) The size of the mempool\n"
             "  \"chain\": \"xxxx\",           (string) current network name as defined in BIP70 (main, test, regtest)\n"
             "}\n"
@@ -249,6 +265,7 @@ UniValue getmininginfo(const JSONRPCRequest& request)
     obj.push_back(Pair("difficulty",       (double)GetDifficulty()));
     obj.push_back(Pair("errors",           GetWarnings("statusbar")));
     obj.push_back(Pair("networkhashps",    getnetworkhashps(request)));
+    obj.push_back(Pair("hashespersec",     dHashesPerSec.load()));
     obj.push_back(Pair("pooledtx",         (uint64_t)mempool.size()));
     obj.push_back(Pair("chain",            Params().NetworkIDString()));
     return obj;
@@ -471,43 +488,77 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     if (IsInitialBlockDownload())
         throw JSONRPCError(RPC_CLIENT_IN_INITIAL_DOWNLOAD, "AdCoin is downloading blocks...");
 
-    static unsigned int nTransactionsUpdatedLast;
+    if (!g_blocktemplatebuilder)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block template builder not initialized");
+    CBlockTemplateBuilder& builder = *g_blocktemplatebuilder;
+
+    const struct BIP9DeploymentInfo& segwit_info = VersionBitsDeploymentInfo[Consensus::DEPLOYMENT_SEGWIT];
+    // If the caller is indicating segwit support, then allow CreateNewBlock()
+    // to select witness transactions, after segwit activates (otherwise
+    // don't).
+    bool fSupportsSegwit = setClientRules.find(segwit_info.name) != setClientRules.end();
+    CScript scriptDummy = CScript() << OP_TRUE;
 
     if (!lpval.isNull())
     {
-        // Wait to respond until either the best block changes, OR a minute has passed and there are more transactions
+        // Wait to respond until either the best block changes, OR the template's fees have grown
+        // by -blocklongpollfee, OR a minute has passed and the template's fees have changed
         uint256 hashWatchedChain;
         boost::system_time checktxtime;
-        unsigned int nTransactionsUpdatedLastLP;
+        CAmount nFeesLP;
 
         if (lpval.isStr())
         {
-            // Format: <hashBestChain><nTransactionsUpdatedLast>
+            // Format: <hashBestChain><nFees>
             std::string lpstr = lpval.get_str();
 
             hashWatchedChain.SetHex(lpstr.substr(0, 64));
-            nTransactionsUpdatedLastLP = atoi64(lpstr.substr(64));
+            nFeesLP = atoi64(lpstr.substr(64));
         }
         else
         {
             // NOTE: Spec does not specify behaviour for non-string longpollid, but this makes testing easier
             hashWatchedChain = chainActive.Tip()->GetBlockHash();
-            nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
+            CBlockTemplate* plptemplate = builder.GetTemplate(scriptDummy, fSupportsSegwit);
+            if (!plptemplate)
+                throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
+            nFeesLP = -plptemplate->vTxFees[0];
         }
 
+        CAmount nFeeDelta = DEFAULT_BLOCK_LONGPOLL_FEE;
+        if (IsArgSet("-blocklongpollfee"))
+            ParseMoney(GetArg("-blocklongpollfee", ""), nFeeDelta);
+        nFeeDelta = std::max(nFeeDelta, (CAmount)1);
+
         // Release the wallet and main lock while waiting
         LEAVE_CRITICAL_SECTION(cs_main);
         {
             checktxtime = boost::get_system_time() + boost::posix_time::minutes(1);
+            bool fCheckTxs = false;
 
-            boost::unique_lock<boost::mutex> lock(csBestBlock);
-            while (chainActive.Tip()->GetBlockHash() == hashWatchedChain && IsRPCRunning())
+            while (IsRPCRunning())
             {
-                if (!cvBlockChange.timed_wait(lock, checktxtime))
+                CAmount nFeesAddedSeen;
+                unsigned int nChangesSeen = builder.GetChanges(nFeesAddedSeen);
+                CAmount nFeesMissing = nFeeDelta;
                 {
-                    // Timeout: Check transactions for update
-                    if (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP)
+                    LOCK(cs_main);
+                    if (chainActive.Tip()->GetBlockHash() != hashWatchedChain)
                         break;
+                    CBlockTemplate* plptemplate = builder.GetTemplate(scriptDummy, fSupportsSegwit);
+                    if (plptemplate) {
+                        CAmount nFees = -plptemplate->vTxFees[0];
+                        if (nFees >= nFeesLP + nFeeDelta || (fCheckTxs && nFees != nFeesLP))
+                            break;
+                        nFeesMissing = fCheckTxs ? 1 : nFeesLP + nFeeDelta - nFees;
+                    }
+                }
+                // Only come back for cs_main once the additions alone could make up the
+                // missing fees, or the template has to be rebuilt
+                if (!builder.WaitForChange(nChangesSeen, nFeesAddedSeen + nFeesMissing, checktxtime))
+                {
+                    // Timeout: Check transactions for update
+                    fCheckTxs = true;
                     checktxtime += boost::posix_time::seconds(10);
                 }
             }
@@ -519,41 +570,11 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
         // TODO: Maybe recheck connections/IBD and (if something wrong) send an expires-immediately template to stop miners?
     }
 
-    const struct BIP9DeploymentInfo& segwit_info = VersionBitsDeploymentInfo[Consensus::DEPLOYMENT_SEGWIT];
-    // If the caller is indicating segwit support, then allow CreateNewBlock()
-    // to select witness transactions, after segwit activates (otherwise
-    // don't).
-    bool fSupportsSegwit = setClientRules.find(segwit_info.name) != setClientRules.end();
-
     // Update block
-    static CBlockIndex* pindexPrev;
-    static int64_t nStart;
-    static std::unique_ptr<CBlockTemplate> pblocktemplate;
-    // Cache whether the last invocation was with segwit support, to avoid returning
-    // a segwit-block to a non-segwit caller.
-    static bool fLastTemplateSupportsSegwit = true;
-    if (pindexPrev != chainActive.Tip() ||
-        (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5) ||
-        fLastTemplateSupportsSegwit != fSupportsSegwit)
-    {
-        // Clear pindexPrev so future calls make a new block, despite any failures from here on
-        pindexPrev = nullptr;
-
-        // Store the pindexBest used before CreateNewBlock, to avoid races
-        nTransactionsUpdatedLast = mempool.GetTransactionsUpdated();
-        CBlockIndex* pindexPrevNew = chainActive.Tip();
-        nStart = GetTime();
-        fLastTemplateSupportsSegwit = fSupportsSegwit;
-
-        // Create new block
-        CScript scriptDummy = CScript() << OP_TRUE;
-        pblocktemplate = BlockAssembler(Params()).CreateNewBlock(scriptDummy, fSupportsSegwit);
-        if (!pblocktemplate)
-            throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
-
-        // Need to update only after we know CreateNewBlock succeeded
-        pindexPrev = pindexPrevNew;
-    }
+    CBlockIndex* pindexPrev = chainActive.Tip();
+    CBlockTemplate* pblocktemplate = builder.GetTemplate(scriptDummy, fSupportsSegwit);
+    if (!pblocktemplate)
+        throw JSONRPCError(RPC_OUT_OF_MEMORY, "Out of memory");
     CBlock* pblock = &pblocktemplate->block; // pointer for convenience
     const Consensus::Params& consensusParams = Params().GetConsensus();
 
@@ -676,7 +697,7 @@ UniValue getblocktemplate(const JSONRPCRequest& request)
     result.push_back(Pair("transactions", transactions));
     result.push_back(Pair("coinbaseaux", aux));
     result.push_back(Pair("coinbasevalue", (int64_t)pblock->vtx[0]->vout[0].nValue));
-    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(nTransactionsUpdatedLast)));
+    result.push_back(Pair("longpollid", chainActive.Tip()->GetBlockHash().GetHex() + i64tostr(-pblocktemplate->vTxFees[0])));
     result.push_back(Pair("target", hashTarget.GetHex()));
     result.push_back(Pair("mintime", (int64_t)pindexPrev->GetMedianTimePast()+1));
     result.push_back(Pair("mutable", aMutable));
@@ -282,9 +282,14 @@ UniValue gettxoutproof(const JSONRPCRequest& request)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        // Loop through txids and try to find which block they're in. Exit loop once a block is found.
+        for (const auto& tx : setTxids) {
+            const Coin& coin = AccessByTxid(*pcoinsTip, tx);
+            if (!coin.IsSpent()) {
+                pblockindex = chainActive[coin.nHeight];
+                break;
+            }
+        }
     }
 
     if (pblockindex == NULL)
@@ -691,9 +696,7 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         BOOST_FOREACH(const CTxIn& txin, mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -744,24 +747,27 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
             if (nOut < 0)
                 throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "vout must be positive");
 
+            COutPoint out(txid, nOut);
+
             vector<unsigned char> pkData(ParseHexO(prevOut, "scriptPubKey"));
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -816,33 +822,35 @@ UniValue signrawtransaction(const JSONRPCRequest& request)
     // Use CTransaction for the constant parts of the
     // transaction to avoid rehashing.
     const CTransaction txConst(mergedTx);
+    // Hashes shared by the signatures of all inputs are only computed once.
+    const PrecomputedTransactionData txdata(txConst);
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = coin.out.scriptPubKey;
+        const CAmount& amount = coin.out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            ProduceSignature(MutableTransactionSignatureCreator(&keystore, &mergedTx, i, amount, nHashType), prevPubKey, sigdata);
+            ProduceSignature(TransactionSignatureCreator(&keystore, &txConst, i, amount, nHashType, &txdata), prevPubKey, sigdata);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CMutableTransaction& txv, txVariants) {
             if (txv.vin.size() > i) {
-                sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount), sigdata, DataFromTransaction(txv, i));
+                sigdata = CombineSignatures(prevPubKey, TransactionSignatureChecker(&txConst, i, amount, txdata), sigdata, DataFromTransaction(txv, i));
             }
         }
 
         UpdateTransaction(mergedTx, i, sigdata);
 
         ScriptError serror = SCRIPT_ERR_OK;
-        if (!VerifyScript(txin.scriptSig, prevPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount), &serror)) {
+        if (!VerifyScript(txin.scriptSig, prevPubKey, &txin.scriptWitness, STANDARD_SCRIPT_VERIFY_FLAGS, TransactionSignatureChecker(&txConst, i, amount, txdata), &serror)) {
             TxInErrorToJSON(txin, vErrors, ScriptErrorString(serror));
         }
     }
@@ -881,7 +889,6 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
             + HelpExampleRpc("sendrawtransaction", "\"signedhex\"")
         );
 
-    LOCK(cs_main);
     RPCTypeCheck(request.params, boost::assign::list_of(UniValue::VSTR)(UniValue::VBOOL));
 
     // parse hex string from parameter
@@ -896,10 +903,18 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     if (request.params.size() > 1 && request.params[1].get_bool())
         nMaxRawTxFee = 0;
 
+    // Verify the scripts before taking cs_main for the rest
+    PrevalidateTransactions(mempool, std::vector<CTransactionRef>(1, tx), nMaxRawTxFee);
+
+    LOCK(cs_main);
+
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -928,6 +943,155 @@ UniValue sendrawtransaction(const JSONRPCRequest& request)
     return hashTx.GetHex();
 }
 
+UniValue sendrawtransactions(const JSONRPCRequest& request)
+{
+    if (request.fHelp || request.params.size() < 1 || request.params.size() > 2)
+        throw runtime_error(
+            "sendrawtransactions [\"hexstring\",...] ( allowhighfees )\n"
+            "\nSubmits a batch of raw transactions (serialized, hex-encoded) to local node and network.\n"
+            "\nTransactions may spend outputs of other transactions in the same batch, in any order.\n"
+            "Each transaction is accepted or rejected on its own; a rejected transaction does not\n"
+            "stop the others from being submitted.\n"
+            "\nArguments:\n"
+            "1. \"hexstrings\"   (array, required) The hex strings of the raw transactions\n"
+            "2. allowhighfees    (boolean, optional, default=false) Allow high fees\n"
+            "\nResult:\n"
+            "[                   (json array of objects, in the same order as the input)\n"
+            "  {\n"
+            "    \"txid\" : \"id\",    (string) The transaction hash in hex, absent if it could not be decoded\n"
+            "    \"accepted\" : true|false, (boolean) Whether the transaction is in the mempool\n"
+            "    \"error\" : \"msg\"   (string) Why the transaction was rejected, only present if it was\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("sendrawtransactions", "\"[\\\"signedhex1\\\",\\\"signedhex2\\\"]\"") +
+            "\nAs a json rpc call\n"
+            + HelpExampleRpc("sendrawtransactions", "[\"signedhex1\",\"signedhex2\"]")
+        );
+
+    RPCTypeCheck(request.params, boost::assign::list_of(UniValue::VARR)(UniValue::VBOOL));
+
+    const UniValue& hexstrings = request.params[0].get_array();
+    const size_t nTx = hexstrings.size();
+
+    // parse hex strings from parameter, remembering why each one failed
+    std::vector<CTransactionRef> vtx(nTx);
+    std::vector<std::string> vError(nTx);
+    std::map<uint256, size_t> mapIndex;
+    for (size_t i = 0; i < nTx; i++) {
+        CMutableTransaction mtx;
+        if (!hexstrings[i].isStr() || !DecodeHexTx(mtx, hexstrings[i].get_str())) {
+            vError[i] = "TX decode failed";
+            continue;
+        }
+        vtx[i] = MakeTransactionRef(std::move(mtx));
+        mapIndex.insert(std::make_pair(vtx[i]->GetHash(), i));
+    }
+
+    // Order the batch so that parents within it are submitted before their children
+    std::vector<std::set<size_t> > vChildren(nTx);
+    std::vector<size_t> vParentCount(nTx, 0);
+    for (size_t i = 0; i < nTx; i++) {
+        if (!vtx[i])
+            continue;
+        std::set<size_t> setParents;
+        BOOST_FOREACH(const CTxIn& txin, vtx[i]->vin) {
+            std::map<uint256, size_t>::const_iterator it = mapIndex.find(txin.prevout.hash);
+            if (it != mapIndex.end() && it->second != i)
+                setParents.insert(it->second);
+        }
+        BOOST_FOREACH(size_t j, setParents) {
+            vChildren[j].insert(i);
+        }
+        vParentCount[i] = setParents.size();
+    }
+    std::vector<size_t> vOrder;
+    vOrder.reserve(nTx);
+    for (size_t i = 0; i < nTx; i++) {
+        if (vtx[i] && vParentCount[i] == 0)
+            vOrder.push_back(i);
+    }
+    for (size_t k = 0; k < vOrder.size(); k++) {
+        BOOST_FOREACH(size_t j, vChildren[vOrder[k]]) {
+            if (--vParentCount[j] == 0)
+                vOrder.push_back(j);
+        }
+    }
+
+    std::vector<CTransactionRef> vtxOrdered;
+    vtxOrdered.reserve(vOrder.size());
+    BOOST_FOREACH(size_t i, vOrder) {
+        vtxOrdered.push_back(vtx[i]);
+    }
+
+    CAmount nMaxRawTxFee = maxTxFee;
+    if (request.params.size() > 1 && request.params[1].get_bool())
+        nMaxRawTxFee = 0;
+
+    // Verify the scripts of the whole batch before taking cs_main for the rest
+    PrevalidateTransactions(mempool, vtxOrdered, nMaxRawTxFee);
+
+    std::vector<bool> vAccepted(nTx, false);
+    std::vector<CInv> vInv;
+    {
+        LOCK(cs_main);
+        CCoinsViewCache &view = *pcoinsTip;
+        BOOST_FOREACH(size_t i, vOrder) {
+            const CTransactionRef& tx = vtx[i];
+            const uint256& hashTx = tx->GetHash();
+
+            bool fHaveChain = false;
+            for (size_t o = 0; !fHaveChain && o < tx->vout.size(); o++) {
+                const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+                fHaveChain = !existingCoin.IsSpent();
+            }
+            if (fHaveChain) {
+                vError[i] = "transaction already in block chain";
+                continue;
+            }
+            if (!mempool.exists(hashTx)) {
+                CValidationState state;
+                bool fMissingInputs;
+                if (!AcceptToMemoryPool(mempool, state, tx, false, &fMissingInputs, NULL, false, nMaxRawTxFee)) {
+                    if (state.IsInvalid()) {
+                        vError[i] = strprintf("%i: %s", state.GetRejectCode(), state.GetRejectReason());
+                    } else if (fMissingInputs) {
+                        vError[i] = "Missing inputs";
+                    } else {
+                        vError[i] = state.GetRejectReason();
+                    }
+                    continue;
+                }
+            }
+            vAccepted[i] = true;
+            vInv.push_back(CInv(MSG_TX, hashTx));
+        }
+    }
+
+    if(!g_connman)
+        throw JSONRPCError(RPC_CLIENT_P2P_DISABLED, "Error: Peer-to-peer functionality missing or disabled");
+
+    g_connman->ForEachNode([&vInv](CNode* pnode)
+    {
+        BOOST_FOREACH(const CInv& inv, vInv) {
+            pnode->PushInventory(inv);
+        }
+    });
+
+    UniValue result(UniValue::VARR);
+    for (size_t i = 0; i < nTx; i++) {
+        UniValue entry(UniValue::VOBJ);
+        if (vtx[i])
+            entry.push_back(Pair("txid", vtx[i]->GetHash().GetHex()));
+        entry.push_back(Pair("accepted", vAccepted[i]));
+        if (!vAccepted[i])
+            entry.push_back(Pair("error", vError[i]));
+        result.push_back(entry);
+    }
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -936,6 +1100,7 @@ static const CRPCCommand commands[] =
     { "rawtransactions",    "decoderawtransaction",   &decoderawtransaction,   true,  {"hexstring"} },
     { "rawtransactions",    "decodescript",           &decodescript,           true,  {"hexstring"} },
     { "rawtransactions",    "sendrawtransaction",     &sendrawtransaction,     false, {"hexstring","allowhighfees"} },
+    { "rawtransactions",    "sendrawtransactions",    &sendrawtransactions,    false, {"hexstrings","allowhighfees"} },
     { "rawtransactions",    "signrawtransaction",     &signrawtransaction,     false, {"hexstring","prevtxs","privkeys","sighashtype"} }, /* uses wallet if enabled */
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true,  {"txids", "blockhash"} },
@@ -11,6 +11,7 @@
 #include "crypto/sha256.h"
 #include "pubkey.h"
 #include "script/script.h"
+#include "streams.h"
 #include "uint256.h"
 
 using namespace std;
@@ -1166,6 +1167,11 @@ uint256 GetOutputsHash(const CTransaction& txTo) {
     return ss.GetHash();
 }
 
+/** Inputs between the hash states kept for legacy signature hashes */
+const unsigned int LEGACY_MIDSTATE_INTERVAL = 16;
+/** Size of a blanked input: prevout, empty script and nSequence */
+const size_t LEGACY_BLANKED_INPUT_SIZE = 36 + 1 + 4;
+
 } // anon namespace
 
 PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
@@ -1173,6 +1179,32 @@ PrecomputedTransactionData::PrecomputedTransactionData(const CTransaction& txTo)
     hashPrevouts = GetPrevoutHash(txTo);
     hashSequence = GetSequenceHash(txTo);
     hashOutputs = GetOutputsHash(txTo);
+
+    bool fLegacyInputs = false;
+    for (const CTxIn& txin : txTo.vin) {
+        fLegacyInputs |= txin.scriptWitness.IsNull();
+    }
+    if (!fLegacyInputs)
+        return;
+
+    CVectorWriter writer(SER_GETHASH, 0, vchLegacyBlanked, 0);
+    writer << txTo.nVersion;
+    WriteCompactSize(writer, txTo.vin.size());
+    size_t nInputsBegin = vchLegacyBlanked.size();
+    for (const CTxIn& txin : txTo.vin) {
+        writer << txin.prevout << CScriptBase() << txin.nSequence;
+    }
+    writer << txTo.vout << txTo.nLockTime;
+    assert(vchLegacyBlanked.size() >= nInputsBegin + txTo.vin.size() * LEGACY_BLANKED_INPUT_SIZE);
+
+    CHashWriter ss(SER_GETHASH, 0);
+    ss.write((const char*)vchLegacyBlanked.data(), nInputsBegin);
+    vLegacyMidstates.reserve((txTo.vin.size() + LEGACY_MIDSTATE_INTERVAL - 1) / LEGACY_MIDSTATE_INTERVAL);
+    for (size_t nIn = 0; nIn < txTo.vin.size(); nIn += LEGACY_MIDSTATE_INTERVAL) {
+        if (nIn > 0)
+            ss.write((const char*)vchLegacyBlanked.data() + nInputsBegin + (nIn - LEGACY_MIDSTATE_INTERVAL) * LEGACY_BLANKED_INPUT_SIZE, LEGACY_MIDSTATE_INTERVAL * LEGACY_BLANKED_INPUT_SIZE);
+        vLegacyMidstates.push_back(ss);
+    }
 }
 
 uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType, const CAmount& amount, SigVersion sigversion, const PrecomputedTransactionData* cache)
@@ -1239,6 +1271,25 @@ uint256 SignatureHash(const CScript& scriptCode, const CTransaction& txTo, unsig
     // Wrapper to serialize only the necessary parts of the transaction being signed
     CTransactionSignatureSerializer txTmp(txTo, scriptCode, nIn, nHashType);
 
+    // For SIGHASH_ALL, everything but the input being signed is shared by all
+    // inputs: continue from the nearest hash state over the blanked
+    // serialization, and only serialize the input itself.
+    if (cache && !cache->vchLegacyBlanked.empty() && !(nHashType & SIGHASH_ANYONECANPAY) &&
+        (nHashType & 0x1f) != SIGHASH_SINGLE && (nHashType & 0x1f) != SIGHASH_NONE) {
+        const char* pch = (const char*)cache->vchLegacyBlanked.data();
+        size_t nInputsBegin = 4 + GetSizeOfCompactSize(txTo.vin.size());
+        size_t nMidstate = nIn / LEGACY_MIDSTATE_INTERVAL;
+        size_t nFrom = nInputsBegin + nMidstate * LEGACY_MIDSTATE_INTERVAL * LEGACY_BLANKED_INPUT_SIZE;
+        size_t nTo = nInputsBegin + nIn * LEGACY_BLANKED_INPUT_SIZE;
+        CHashWriter ss(cache->vLegacyMidstates[nMidstate]);
+        ss.write(pch + nFrom, nTo - nFrom);
+        txTmp.SerializeInput(ss, nIn);
+        nFrom = nTo + LEGACY_BLANKED_INPUT_SIZE;
+        ss.write(pch + nFrom, cache->vchLegacyBlanked.size() - nFrom);
+        ss << nHashType;
+        return ss.GetHash();
+    }
+
     // Serialize and hash
     CHashWriter ss(SER_GETHASH, 0);
     ss << txTmp << nHashType;
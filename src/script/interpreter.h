@@ -6,6 +6,7 @@
 #ifndef BITCOIN_SCRIPT_INTERPRETER_H
 #define BITCOIN_SCRIPT_INTERPRETER_H
 
+#include "hash.h"
 #include "script_error.h"
 #include "primitives/transaction.h"
 
@@ -114,6 +115,14 @@ struct PrecomputedTransactionData
 {
     uint256 hashPrevouts, hashSequence, hashOutputs;
 
+    /** The legacy SIGHASH_ALL serialization of the transaction with every
+     *  scriptSig blanked. Signature hashes of the individual inputs only
+     *  differ from it in the input being signed. Empty if every input has a
+     *  witness. */
+    std::vector<unsigned char> vchLegacyBlanked;
+    /** Hash states over vchLegacyBlanked up to input 0, LEGACY_MIDSTATE_INTERVAL, 2 * LEGACY_MIDSTATE_INTERVAL, ... */
+    std::vector<CHashWriter> vLegacyMidstates;
+
     PrecomputedTransactionData(const CTransaction& tx);
 };
 
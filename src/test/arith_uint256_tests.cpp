@@ -366,6 +366,16 @@ BOOST_AUTO_TEST_CASE( divide )
     BOOST_CHECK(R2L / MaxL == ZeroL);
     BOOST_CHECK(MaxL / R2L == 1);
     BOOST_CHECK_THROW(R2L / ZeroL, uint_error);
+
+    // Divisors of up to 32 bits take the short division path
+    BOOST_CHECK((R1L / 0xffffffff).ToString() == "000000007d1de5eb76cf3cc0a8d82cf45e82ae173154e3748f670c9fa178636f");
+    BOOST_CHECK((R1L / 25).ToString() == "050132281e77bbcb167b3ccede4e800ba2086888dacd86c4486717f3d5925539");
+    BOOST_CHECK((R1L / 0x10000) == (R1L >> 16));
+    BOOST_CHECK((R2L / 0xffffffff).ToString() == "00000000d781cab5c7f3ddff39ce0b18dd153b2c9ccbd7d35fd655f9a041fb41");
+    BOOST_CHECK((R2L / 25).ToString() == "089ecaab13db9a5f1908ba1fbed9e333fd6db45897296134bae595f89e908723");
+    BOOST_CHECK((R2L / 0x10000) == (R2L >> 16));
+    BOOST_CHECK(OneL / 2 == ZeroL);
+    BOOST_CHECK(MaxL / 1 == MaxL);
 }
 
 
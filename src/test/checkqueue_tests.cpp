@@ -0,0 +1,110 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+static std::atomic<int> nChecksRun;
+
+struct CountingCheck
+{
+    bool fOk;
+    CountingCheck(bool fOkIn = true) : fOk(fOkIn) {}
+    bool operator()()
+    {
+        nChecksRun++;
+        return fOk;
+    }
+    void swap(CountingCheck& x) { std::swap(fOk, x.fOk); }
+};
+
+static void RunQueue(int nWorkers)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group tg;
+    for (int i = 0; i < nWorkers; i++)
+        tg.create_thread([&]{ queue.Thread(); });
+
+    for (int nRound = 0; nRound < 100; nRound++) {
+        // Every check runs exactly once, however the checks are added
+        nChecksRun = 0;
+        int nTotal = 0;
+        {
+            CCheckQueueControl<CountingCheck> control(&queue);
+            for (int i = 0; i < nRound; i++) {
+                std::vector<CountingCheck> vChecks(i % 7);
+                nTotal += vChecks.size();
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        BOOST_CHECK_EQUAL(nChecksRun, nTotal);
+        BOOST_CHECK(queue.IsIdle());
+
+        // A single failure fails the whole run, and the queue is reusable
+        // afterwards
+        {
+            CCheckQueueControl<CountingCheck> control(&queue);
+            for (int i = 0; i < 10; i++) {
+                std::vector<CountingCheck> vChecks(20);
+                if (i == nRound % 10)
+                    vChecks[nRound % 20].fOk = false;
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(!control.Wait());
+        }
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_run)
+{
+    RunQueue(0);
+    RunQueue(1);
+    RunQueue(3);
+    // More workers than the queue has deques for
+    RunQueue(80);
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_concurrent_masters)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group tg;
+    for (int i = 0; i < 2; i++)
+        tg.create_thread([&]{ queue.Thread(); });
+
+    // Masters take turns, so each sees only the result of its own checks
+    std::atomic<int> nWrong(0);
+    auto master = [&](bool fOk) {
+        for (int nRound = 0; nRound < 100; nRound++) {
+            CCheckQueueControl<CountingCheck> control(&queue);
+            std::vector<CountingCheck> vChecks(nRound % 30 + 1);
+            vChecks.back().fOk = fOk;
+            control.Add(vChecks);
+            if (control.Wait() != fOk)
+                nWrong++;
+        }
+    };
+    boost::thread_group masters;
+    masters.create_thread([&]{ master(true); });
+    masters.create_thread([&]{ master(false); });
+    masters.join_all();
+    BOOST_CHECK_EQUAL(nWrong, 0);
+    BOOST_CHECK(queue.IsIdle());
+
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,89 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coinstats.h"
+#include "consensus/validation.h"
+#include "key.h"
+#include "script/standard.h"
+#include "txdb.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinstats_tests, TestChain100Setup)
+
+// Compares the maintained statistics with a full walk over the database
+static void CheckMaintainedStats()
+{
+    CCoinsStats stats;
+    CUTXOStats maintained;
+    BOOST_CHECK(GetUTXOStats(stats, &maintained));
+    BOOST_CHECK(stats.utxo.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK(maintained.hashBlock == stats.utxo.hashBlock);
+    BOOST_CHECK_EQUAL(stats.nHeight, chainActive.Height());
+    BOOST_CHECK_EQUAL(maintained.nTransactionOutputs, stats.utxo.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(maintained.nBogoSize, stats.utxo.nBogoSize);
+    BOOST_CHECK_EQUAL(maintained.nTotalAmount, stats.utxo.nTotalAmount);
+    BOOST_CHECK(maintained.GetHash() == stats.utxo.GetHash());
+}
+
+BOOST_AUTO_TEST_CASE(coinstats_maintained)
+{
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(fUTXOStatsComplete);
+    }
+    CheckMaintainedStats();
+    CCoinsStats stats;
+    BOOST_CHECK(GetUTXOStats(stats));
+    // Every block of the test chain has a single coinbase output
+    BOOST_CHECK_EQUAL(stats.nTransactions, (uint64_t)chainActive.Height());
+    CUTXOStats statsBefore = stats.utxo;
+
+    // Spend a coinbase into two outputs
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spend.vout.resize(2);
+    spend.vout[0].nValue = 11 * CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+    spend.vout[1].nValue = 12 * CENT;
+    spend.vout[1].scriptPubKey = scriptPubKey;
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+    CBlock block = CreateAndProcessBlock(std::vector<CMutableTransaction>(1, spend), scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    CheckMaintainedStats();
+
+    // Disconnecting the block restores the previous statistics
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+        BOOST_CHECK(utxoStats.GetHash() == statsBefore.GetHash());
+        BOOST_CHECK_EQUAL(utxoStats.nTotalAmount, statsBefore.nTotalAmount);
+    }
+    CheckMaintainedStats();
+
+    // They are saved with the chain state, and rebuilt if they don't match it
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(LoadUTXOStats());
+        BOOST_CHECK(utxoStats.GetHash() == statsBefore.GetHash());
+        BOOST_CHECK(pblocktree->WriteUTXOStats(CUTXOStats()));
+        BOOST_CHECK(!LoadUTXOStats());
+        BOOST_CHECK(!fUTXOStatsComplete);
+    }
+    ThreadRebuildUTXOStats();
+    CheckMaintainedStats();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
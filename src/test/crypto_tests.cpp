@@ -3,12 +3,15 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto/aes.h"
+#include "crypto/common.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "crypto/muhash.h"
+#include "streams.h"
 #include "utilstrencodings.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
@@ -439,4 +442,56 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+
+static uint256 FromMuHash(const MuHash3072& h)
+{
+    uint256 hash;
+    h.Finalize(hash.begin());
+    return hash;
+}
+
+static MuHash3072& Insert(MuHash3072& h, const std::string& s) { return h.Insert((const unsigned char*)s.data(), s.size()); }
+static MuHash3072& Remove(MuHash3072& h, const std::string& s) { return h.Remove((const unsigned char*)s.data(), s.size()); }
+
+BOOST_AUTO_TEST_CASE(muhash_tests)
+{
+    // Independently computed with Python integers
+    BOOST_CHECK_EQUAL(FromMuHash(MuHash3072()).GetHex(), "dd5ad2a105c2d29495f577245c357409002329b9f4d6182c0af3dc2f462555c8");
+    MuHash3072 a, b;
+    Insert(Insert(Insert(a, "abc"), "xyz"), "123");
+    Remove(a, "123");
+    Insert(Insert(b, "xyz"), "abc");
+    BOOST_CHECK_EQUAL(FromMuHash(a).GetHex(), "e6d8354e7e429ed78cce7a8e5a1b52f9bbcea88cfb52b8d439ef7bdd4ccc258a");
+    BOOST_CHECK(FromMuHash(a) == FromMuHash(b));
+
+    // Combining sets, and removing them again
+    MuHash3072 c, d;
+    Insert(c, "abc");
+    Insert(d, "xyz");
+    c *= d;
+    BOOST_CHECK(FromMuHash(c) == FromMuHash(b));
+    c /= b;
+    BOOST_CHECK(FromMuHash(c) == FromMuHash(MuHash3072()));
+
+    // The serialized state round-trips
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << a;
+    MuHash3072 e;
+    ss >> e;
+    BOOST_CHECK(FromMuHash(e) == FromMuHash(a));
+
+    // (p - 1)^2 == 1 exercises the carries of the modular reduction
+    unsigned char data[Num3072::BYTE_SIZE];
+    memset(data, 0xff, sizeof(data));
+    WriteLE32(data, 0xFFFFFFFFUL - 1103717);
+    Num3072 minus_one(data);
+    Num3072 x = minus_one;
+    x.Multiply(minus_one);
+    Num3072 one;
+    BOOST_CHECK(memcmp(x.limbs, one.limbs, sizeof(one.limbs)) == 0);
+    x = minus_one;
+    x.Divide(minus_one);
+    BOOST_CHECK(memcmp(x.limbs, one.limbs, sizeof(one.limbs)) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,161 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "flatmap.h"
+#include "memusage.h"
+
+#include "test/test_bitcoin.h"
+#include "test/test_random.h"
+
+#include <map>
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(flatmap_tests, BasicTestingSetup)
+
+namespace
+{
+// Deliberately poor hash, so that probe sequences collide and wrap around
+struct WeakHasher
+{
+    size_t operator()(int key) const { return key % 64; }
+};
+
+typedef flatmap<int, std::string, WeakHasher> TestMap;
+
+void CheckEqual(const TestMap& map, const std::map<int, std::string>& expected)
+{
+    BOOST_CHECK_EQUAL(map.size(), expected.size());
+    size_t count = 0;
+    for (TestMap::const_iterator it = map.begin(); it != map.end(); ++it) {
+        std::map<int, std::string>::const_iterator found = expected.find(it->first);
+        BOOST_CHECK(found != expected.end() && found->second == it->second);
+        count++;
+    }
+    BOOST_CHECK_EQUAL(count, expected.size());
+}
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_random)
+{
+    TestMap map;
+    std::map<int, std::string> expected;
+
+    for (int i = 0; i < 20000; i++) {
+        int key = insecure_rand() % 2000;
+        switch (insecure_rand() % 4) {
+        case 0:
+        case 1: {
+            std::string value(insecure_rand() % 40, 'a' + key % 26);
+            bool inserted = map.insert(std::make_pair(key, value)).second;
+            BOOST_CHECK_EQUAL(inserted, expected.insert(std::make_pair(key, value)).second);
+            break;
+        }
+        case 2:
+            BOOST_CHECK_EQUAL(map.erase(key), expected.erase(key));
+            break;
+        case 3: {
+            TestMap::iterator it = map.find(key);
+            BOOST_CHECK_EQUAL(it != map.end(), expected.count(key) == 1);
+            if (it != map.end()) {
+                BOOST_CHECK(it->second == expected[key]);
+                it->second += "x";
+                expected[key] += "x";
+            }
+            break;
+        }
+        }
+        if (i % 1000 == 0) CheckEqual(map, expected);
+    }
+    CheckEqual(map, expected);
+
+    // Erasing while iterating visits every entry once
+    size_t total = map.size();
+    size_t visited = 0;
+    for (TestMap::iterator it = map.begin(); it != map.end(); ) {
+        if (it->first % 2) {
+            expected.erase(it->first);
+            map.erase(it++);
+        } else {
+            ++it;
+        }
+        visited++;
+    }
+    BOOST_CHECK_EQUAL(visited, total);
+    CheckEqual(map, expected);
+
+    map.clear();
+    BOOST_CHECK(map.empty());
+    BOOST_CHECK(map.begin() == map.end());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_stable_references)
+{
+    // Entries live in the arena, so growing the table must not move them
+    TestMap map;
+    std::string& first = map[0];
+    first = "first";
+    size_t usage = memusage::DynamicUsage(map);
+    for (int i = 1; i < 10000; i++) {
+        map[i] = "value";
+    }
+    BOOST_CHECK(&map.find(0)->second == &first);
+    BOOST_CHECK_EQUAL(first, "first");
+    BOOST_CHECK(memusage::DynamicUsage(map) > usage);
+
+    // Erased entries are recycled instead of growing the arena
+    for (int i = 1; i < 10000; i++) {
+        map.erase(i);
+    }
+    usage = memusage::DynamicUsage(map);
+    for (int i = 1; i < 5000; i++) {
+        map[i] = "again";
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+    BOOST_CHECK_EQUAL(map.size(), 5000);
+}
+
+BOOST_AUTO_TEST_CASE(flatmap_compact)
+{
+    TestMap map;
+    std::map<int, std::string> expected;
+    for (int i = 0; i < 10000; i++) {
+        map[i] = expected[i] = std::string(i % 40, 'a' + i % 26);
+    }
+    BOOST_CHECK(!map.compact());
+
+    // Once most entries are gone the arena and the table shrink to fit the rest
+    size_t usage = memusage::DynamicUsage(map);
+    for (int i = 0; i < 10000; i++) {
+        if (i % 10) {
+            map.erase(i);
+            expected.erase(i);
+        }
+    }
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), usage);
+    BOOST_CHECK(map.compact());
+    BOOST_CHECK(memusage::DynamicUsage(map) * 5 < usage);
+    BOOST_CHECK(!map.compact());
+    CheckEqual(map, expected);
+
+    // The compacted map keeps working as usual
+    for (int i = 0; i < 10000; i++) {
+        if (i % 10 == 1) {
+            map[i] = expected[i] = "again";
+        }
+    }
+    BOOST_CHECK_EQUAL(map.erase(0), 1);
+    expected.erase(0);
+    CheckEqual(map, expected);
+
+    for (int i = 0; i < 10000; i++) {
+        map.erase(i);
+    }
+    BOOST_CHECK(map.compact());
+    BOOST_CHECK_EQUAL(memusage::DynamicUsage(map), 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,7 @@
 
 #include "hash.h"
 #include "utilstrencodings.h"
+#include "crypto/common.h"
 #include "test/test_bitcoin.h"
 
 #include <vector>
@@ -128,6 +129,17 @@ BOOST_AUTO_TEST_CASE(siphash)
     tx.nVersion = 1;
     ss << tx;
     BOOST_CHECK_EQUAL(SipHashUint256(1, 2, ss.GetHash()), 0x79751e980c2a0a35ULL);
+
+    // Check SipHashUint256Extra against the generic implementation on the
+    // serialized outpoint (hash followed by the little-endian index)
+    uint256 hashOut = ss.GetHash();
+    for (uint32_t n = 0; n < 3; n++) {
+        unsigned char vchIndex[4];
+        WriteLE32(vchIndex, n);
+        CSipHasher hasher4(1, 2);
+        hasher4.Write(hashOut.begin(), hashOut.size()).Write(vchIndex, sizeof(vchIndex));
+        BOOST_CHECK_EQUAL(SipHashUint256Extra(1, 2, hashOut, n), hasher4.Finalize());
+    }
 }
 
 BOOST_AUTO_TEST_SUITE_END()
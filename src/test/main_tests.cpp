@@ -2,9 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
 #include "chainparams.h"
+#include "consensus/validation.h"
 #include "validation.h"
 #include "net.h"
+#include "pow.h"
 
 #include "test/test_bitcoin.h"
 
@@ -74,4 +77,110 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+struct RegtestingSetup : public TestingSetup {
+    RegtestingSetup() : TestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_CASE(process_new_block_headers, RegtestingSetup)
+{
+    const CChainParams& chainparams = Params();
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+
+    std::vector<CBlockHeader> headers;
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = chainparams.GenesisBlock().GetHash();
+    header.nTime = chainparams.GenesisBlock().nTime;
+    header.nBits = UintToArith256(consensusParams.powLimit).GetCompact();
+    for (int i = 0; i < 20; i++) {
+        header.nTime += consensusParams.nPowTargetSpacing;
+        header.nNonce = 0;
+        while (!CheckProofOfWork(header.GetPoWHash(), header.nBits, consensusParams))
+            header.nNonce++;
+        headers.push_back(header);
+        header.hashPrevBlock = header.GetHash();
+    }
+
+    // Break the work of a header halfway through a second batch
+    std::vector<CBlockHeader> badheaders(headers.begin() + 10, headers.end());
+    while (CheckProofOfWork(badheaders[5].GetPoWHash(), badheaders[5].nBits, consensusParams))
+        badheaders[5].nNonce++;
+
+    CValidationState state;
+    const CBlockIndex* pindex = NULL;
+    BOOST_CHECK(ProcessNewBlockHeaders(std::vector<CBlockHeader>(headers.begin(), headers.begin() + 10), state, chainparams, &pindex));
+    BOOST_CHECK(!ProcessNewBlockHeaders(badheaders, state, chainparams, &pindex));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    BOOST_CHECK_EQUAL(pindex->nHeight, 15);
+
+    // A batch whose first header lacks the work is rejected before the rest is hashed
+    std::vector<CBlockHeader> badfirst(headers.begin() + 15, headers.end());
+    while (CheckProofOfWork(badfirst[0].GetPoWHash(), badfirst[0].nBits, consensusParams))
+        badfirst[0].nNonce++;
+    state = CValidationState();
+    BOOST_CHECK(!ProcessNewBlockHeaders(badfirst, state, chainparams, &pindex));
+    BOOST_CHECK_EQUAL(state.GetRejectReason(), "high-hash");
+    BOOST_CHECK_EQUAL(pindex->nHeight, 15);
+
+    state = CValidationState();
+    BOOST_CHECK(ProcessNewBlockHeaders(headers, state, chainparams, &pindex));
+    BOOST_CHECK_EQUAL(pindex->nHeight, 20);
+    LOCK(cs_main);
+    for (const CBlockHeader& h : headers) {
+        const CBlockIndex* pindexHeader = mapBlockIndex.at(h.GetHash());
+        BOOST_CHECK(pindexHeader->nStatus & BLOCK_HAVE_POW_HASH);
+        BOOST_CHECK(pindexHeader->hashPoW == h.GetPoWHash());
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(read_block_trusted_pow, TestChain100Setup)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    LOCK(cs_main);
+    CBlockIndex* pindex = chainActive.Tip();
+    BOOST_CHECK(pindex->nStatus & BLOCK_HAVE_POW_HASH);
+    const uint256 hashPoW = pindex->hashPoW;
+
+    // Blocks read through their index entry are checked against the stored PoW hash instead of
+    // recomputing it, so a stored hash that misses the target fails them
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, consensusParams));
+    BOOST_CHECK(block.GetPoWHash() == hashPoW);
+    CCoinsViewCache view(pcoinsTip);
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), &view, 1, 1));
+    pindex->hashPoW = uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, consensusParams));
+    BOOST_CHECK(!CVerifyDB().VerifyDB(Params(), &view, 1, 1));
+
+    // Unless every read is checked in full
+    fCheckBlockReadPoW = true;
+    BOOST_CHECK(ReadBlockFromDisk(block, pindex, consensusParams));
+    BOOST_CHECK(CVerifyDB().VerifyDB(Params(), &view, 1, 1));
+    fCheckBlockReadPoW = DEFAULT_CHECK_BLOCK_READ_POW;
+    pindex->hashPoW = hashPoW;
+}
+
+BOOST_FIXTURE_TEST_CASE(reconnect_prepared_blocks, TestChain100Setup)
+{
+    // Each block read back from disk is prepared while its predecessor connects
+    CValidationState state;
+    CBlockIndex* pindexTip;
+    uint64_t nPrepared;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+        nPrepared = GetPreparedBlocksConnected();
+        CBlockIndex* pindexInvalid = chainActive[5];
+        BOOST_CHECK(InvalidateBlock(state, Params(), pindexInvalid));
+        BOOST_CHECK_EQUAL(chainActive.Height(), 4);
+        BOOST_CHECK(ResetBlockFailureFlags(pindexInvalid));
+    }
+    BOOST_CHECK(ActivateBestChain(state, Params()));
+    LOCK(cs_main);
+    BOOST_CHECK(chainActive.Tip() == pindexTip);
+    // All but the first of the blocks reconnected from height 5
+    BOOST_CHECK_EQUAL(GetPreparedBlocksConnected() - nPrepared, chainActive.Height() - 5);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
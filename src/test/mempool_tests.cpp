@@ -9,6 +9,7 @@
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
+#include <algorithm>
 #include <list>
 #include <vector>
 
@@ -429,6 +430,121 @@ BOOST_AUTO_TEST_CASE(MempoolAncestorIndexingTest)
     CheckSort<ancestor_score>(pool, sortedOrder);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolRemoveForBlockTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A spends nothing in the pool, B and C spend A, D spends B and C, E spends D
+    CMutableTransaction tx[5];
+    for (int i = 0; i < 5; i++) {
+        tx[i].vin.resize(i == 3 ? 2 : 1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        tx[i].vout.resize(2);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10 * COIN;
+        tx[i].vout[1] = tx[i].vout[0];
+    }
+    tx[1].vin[0].prevout = COutPoint(tx[0].GetHash(), 0);
+    tx[2].vin[0].prevout = COutPoint(tx[0].GetHash(), 1);
+    tx[3].vin[0].prevout = COutPoint(tx[1].GetHash(), 0);
+    tx[3].vin[1].prevout = COutPoint(tx[2].GetHash(), 0);
+    tx[3].vin[1].scriptSig = CScript() << OP_11;
+    tx[4].vin[0].prevout = COutPoint(tx[3].GetHash(), 0);
+    for (int i = 0; i < 5; i++) {
+        pool.addUnchecked(tx[i].GetHash(), entry.Fee(1000 * (i + 1)).SigOpsCost(i).FromTx(tx[i]));
+    }
+
+    // A block confirming A and B leaves C as a root, with D and E below it
+    std::vector<CTransactionRef> vtx;
+    vtx.push_back(MakeTransactionRef(tx[0]));
+    vtx.push_back(MakeTransactionRef(tx[1]));
+    pool.removeForBlock(vtx, 1);
+    BOOST_CHECK_EQUAL(pool.size(), 3);
+
+    for (int i = 2; i < 5; i++) {
+        CTxMemPool::txiter it = pool.mapTx.find(tx[i].GetHash());
+        BOOST_CHECK_EQUAL(it->GetCountWithAncestors(), i - 1);
+        uint64_t nSize = 0;
+        CAmount nFees = 0;
+        int64_t nSigOps = 0;
+        for (int j = 2; j <= i; j++) {
+            nSize += GetVirtualTransactionSize(tx[j]);
+            nFees += 1000 * (j + 1);
+            nSigOps += j;
+        }
+        BOOST_CHECK_EQUAL(it->GetSizeWithAncestors(), nSize);
+        BOOST_CHECK_EQUAL(it->GetModFeesWithAncestors(), nFees);
+        BOOST_CHECK_EQUAL(it->GetSigOpCostWithAncestors(), nSigOps);
+        BOOST_CHECK_EQUAL(pool.GetMemPoolParents(it).size(), i == 2 ? 0 : 1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(MempoolLinksTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+
+    // A parent with four children, each also spent by a single grandchild,
+    // so that both link lists outgrow their inline storage
+    CMutableTransaction txParent;
+    txParent.vin.resize(1);
+    txParent.vin[0].scriptSig = CScript() << OP_11;
+    txParent.vout.resize(4);
+    for (int i = 0; i < 4; i++) {
+        txParent.vout[i].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txParent.vout[i].nValue = 10 * COIN;
+    }
+    pool.addUnchecked(txParent.GetHash(), entry.FromTx(txParent));
+
+    CMutableTransaction txChild[4];
+    CMutableTransaction txGrandChild;
+    txGrandChild.vin.resize(4);
+    txGrandChild.vout.resize(1);
+    txGrandChild.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    txGrandChild.vout[0].nValue = 39 * COIN;
+    for (int i = 0; i < 4; i++) {
+        txChild[i].vin.resize(1);
+        txChild[i].vin[0].scriptSig = CScript() << OP_11;
+        txChild[i].vin[0].prevout = COutPoint(txParent.GetHash(), i);
+        txChild[i].vout.resize(1);
+        txChild[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        txChild[i].vout[0].nValue = 10 * COIN;
+        pool.addUnchecked(txChild[i].GetHash(), entry.FromTx(txChild[i]));
+        txGrandChild.vin[i].scriptSig = CScript() << OP_11;
+        txGrandChild.vin[i].prevout = COutPoint(txChild[i].GetHash(), 0);
+    }
+    pool.addUnchecked(txGrandChild.GetHash(), entry.FromTx(txGrandChild));
+
+    CTxMemPool::txiter parentIt = pool.mapTx.find(txParent.GetHash());
+    CTxMemPool::txiter grandChildIt = pool.mapTx.find(txGrandChild.GetHash());
+    BOOST_CHECK_EQUAL(pool.GetMemPoolChildren(parentIt).size(), 4);
+    BOOST_CHECK_EQUAL(pool.GetMemPoolParents(grandChildIt).size(), 4);
+    BOOST_CHECK_EQUAL(grandChildIt->GetCountWithAncestors(), 6);
+    for (int i = 0; i < 4; i++) {
+        BOOST_CHECK(pool.mapNextTx.count(COutPoint(txParent.GetHash(), i)));
+    }
+
+    // Removing a child takes the grandchild with it and unlinks both
+    size_t nUsage = pool.DynamicMemoryUsage();
+    pool.removeRecursive(txChild[1]);
+    BOOST_CHECK_EQUAL(pool.size(), 4);
+    BOOST_CHECK(pool.DynamicMemoryUsage() < nUsage);
+    BOOST_CHECK(!pool.mapNextTx.count(COutPoint(txParent.GetHash(), 1)));
+    BOOST_CHECK(!pool.mapNextTx.count(COutPoint(txChild[0].GetHash(), 0)));
+    const CTxMemPool::vecEntries& children = pool.GetMemPoolChildren(parentIt);
+    BOOST_CHECK_EQUAL(children.size(), 3);
+    for (int i = 0; i < 4; i++) {
+        CTxMemPool::txiter childIt = pool.mapTx.find(txChild[i].GetHash());
+        BOOST_CHECK_EQUAL(childIt != pool.mapTx.end(), i != 1);
+        if (childIt == pool.mapTx.end())
+            continue;
+        BOOST_CHECK(std::count(children.begin(), children.end(), childIt) == 1);
+        BOOST_CHECK(pool.GetMemPoolChildren(childIt).empty());
+    }
+    BOOST_CHECK_EQUAL(parentIt->GetCountWithDescendants(), 4);
+}
+
 
 BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
 {
@@ -10,7 +10,9 @@
 #include "validation.h"
 #include "miner.h"
 #include "policy/policy.h"
+#include "pow.h"
 #include "pubkey.h"
+#include "random.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -622,4 +624,126 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     // fCheckpointsEnabled = true;
 }
 
+static CMutableTransaction CreateSpend(const CTransaction& txPrev, CAmount nFee, const CKey& key)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(key.GetPubKey()) << OP_CHECKSIG;
+    CMutableTransaction tx;
+    tx.nVersion = 1;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(txPrev.GetHash(), 0);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = txPrev.vout[0].nValue - nFee;
+    tx.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(txPrev.vout[0].scriptPubKey, tx, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    tx.vin[0].scriptSig << vchSig;
+    return tx;
+}
+
+BOOST_FIXTURE_TEST_CASE(BlockTemplateBuilder_incremental, TestChain100Setup)
+{
+    const CChainParams& chainparams = Params();
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    CBlockTemplateBuilder builder(chainparams);
+    CValidationState state;
+
+    CBlockTemplate* pblocktemplate;
+    CMutableTransaction txParent = CreateSpend(coinbaseTxns[0], 10000, coinbaseKey);
+    CMutableTransaction txChild = CreateSpend(txParent, 20000, coinbaseKey);
+    {
+        LOCK(cs_main);
+        pblocktemplate = builder.GetTemplate(scriptPubKey);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+        CAmount nSubsidy = pblocktemplate->block.vtx[0]->vout[0].nValue;
+        CAmount nFeesAddedSeen;
+        unsigned int nChangesSeen = builder.GetChanges(nFeesAddedSeen);
+
+        // New transactions are appended, parents before children, and paid to the coinbase
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txParent), false, NULL, NULL, true, 0));
+        BOOST_CHECK(AcceptToMemoryPool(mempool, state, MakeTransactionRef(txChild), false, NULL, NULL, true, 0));
+
+        // Waiters see their fees without cs_main, and are only woken up once there are enough
+        CAmount nFeesAdded;
+        BOOST_CHECK_EQUAL(builder.GetChanges(nFeesAdded), nChangesSeen);
+        BOOST_CHECK_EQUAL(nFeesAdded, nFeesAddedSeen + 30000);
+        BOOST_CHECK(builder.WaitForChange(nChangesSeen, nFeesAddedSeen + 30000, boost::get_system_time()));
+        BOOST_CHECK(!builder.WaitForChange(nChangesSeen, nFeesAddedSeen + 30001, boost::get_system_time()));
+
+        pblocktemplate = builder.GetTemplate(scriptPubKey);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3);
+        BOOST_CHECK(pblocktemplate->block.vtx[1]->GetHash() == txParent.GetHash());
+        BOOST_CHECK(pblocktemplate->block.vtx[2]->GetHash() == txChild.GetHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -30000);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0]->vout[0].nValue, nSubsidy + 30000);
+        BOOST_CHECK(TestBlockValidity(state, chainparams, pblocktemplate->block, chainActive.Tip(), false, false));
+
+        // The same block as assembling from scratch
+        std::unique_ptr<CBlockTemplate> pblocktemplateNew = BlockAssembler(chainparams).CreateNewBlock(scriptPubKey);
+        BOOST_CHECK_EQUAL(pblocktemplateNew->block.vtx.size(), 3);
+        BOOST_CHECK(pblocktemplateNew->block.vtx[0]->GetHash() == pblocktemplate->block.vtx[0]->GetHash());
+
+        // Removing a transaction in the template assembles it again
+        mempool.removeRecursive(txChild, MemPoolRemovalReason::CONFLICT);
+        BOOST_CHECK(builder.GetChanges(nFeesAdded) != nChangesSeen);
+        pblocktemplate = builder.GetTemplate(scriptPubKey);
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 2);
+        BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -10000);
+    }
+
+    // As does a new tip
+    std::vector<CMutableTransaction> txns(1, txParent);
+    CreateAndProcessBlock(txns, scriptPubKey);
+    {
+        LOCK(cs_main);
+        BOOST_CHECK_EQUAL(mempool.size(), 0);
+        pblocktemplate = builder.GetTemplate(scriptPubKey);
+        BOOST_CHECK(pblocktemplate->block.hashPrevBlock == chainActive.Tip()->GetBlockHash());
+        BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1);
+    }
+
+    mempool.clear();
+}
+
+BOOST_AUTO_TEST_CASE(SearchNonces_threads)
+{
+    const Consensus::Params& params = Params(CBaseChainParams::REGTEST).GetConsensus();
+    CBlockHeader header;
+    header.nVersion = 4;
+    header.hashPrevBlock = GetRandHash();
+    header.hashMerkleRoot = GetRandHash();
+    header.nTime = 1500000000;
+    header.nBits = 0x2000ffff; // About one solution per 256 nonces
+    header.nNonce = 1000;
+
+    // Find a header with a solution in range, and check it is the lowest
+    uint64_t nHashes = 0;
+    uint32_t nFound = 512;
+    for (int i = 0; i < 10 && nFound == 512; i++) {
+        header.nTime++;
+        nHashes = 0;
+        nFound = SearchNonces(header, 512, 1, params, nHashes);
+    }
+    BOOST_REQUIRE(nFound < 512);
+    BOOST_CHECK(nHashes > nFound);
+    for (uint32_t i = 0; i <= nFound; i++) {
+        CBlockHeader candidate = header;
+        candidate.nNonce += i;
+        BOOST_CHECK_EQUAL(CheckProofOfWork(candidate.GetPoWHash(), header.nBits, params), i == nFound);
+    }
+
+    // More threads find the same solution
+    nHashes = 0;
+    BOOST_CHECK_EQUAL(SearchNonces(header, 512, 4, params, nHashes), nFound);
+    BOOST_CHECK(nHashes > nFound);
+
+    // Without a solution every nonce is tried exactly once
+    header.nBits = 0x1d00ffff;
+    nHashes = 0;
+    BOOST_CHECK_EQUAL(SearchNonces(header, 100, 3, params, nHashes), 100);
+    BOOST_CHECK_EQUAL(nHashes, 100);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
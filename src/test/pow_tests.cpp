@@ -4,9 +4,14 @@
 
 #include "chain.h"
 #include "chainparams.h"
+#include "clientversion.h"
+#include "consensus/consensus.h"
 #include "pow.h"
+#include "crypto/scrypt.h"
 #include "random.h"
+#include "streams.h"
 #include "util.h"
+#include "validation.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
@@ -93,4 +98,100 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+/* The stored PoW hash is only serialized when flagged, so older entries still round-trip */
+BOOST_AUTO_TEST_CASE(diskblockindex_pow_hash)
+{
+    CBlockIndex index;
+    uint256 hash = GetRandHash();
+    index.phashBlock = &hash;
+    index.nBits = 0x1e0ffff0;
+    index.nNonce = 42;
+
+    CDataStream ssLegacy(SER_DISK, CLIENT_VERSION);
+    ssLegacy << CDiskBlockIndex(&index);
+
+    index.SetPoWHash(GetRandHash());
+    BOOST_CHECK(index.GetBlockPoWHash() == index.hashPoW);
+
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << CDiskBlockIndex(&index);
+
+    CDiskBlockIndex diskindex;
+    ss >> diskindex;
+    BOOST_CHECK(diskindex.nStatus & BLOCK_HAVE_POW_HASH);
+    BOOST_CHECK(diskindex.hashPoW == index.hashPoW);
+    BOOST_CHECK_EQUAL(diskindex.nNonce, index.nNonce);
+
+    CDiskBlockIndex legacyindex;
+    ssLegacy >> legacyindex;
+    BOOST_CHECK(!(legacyindex.nStatus & BLOCK_HAVE_POW_HASH));
+    BOOST_CHECK(legacyindex.hashPoW.IsNull());
+    BOOST_CHECK(ssLegacy.empty());
+}
+
+static uint256 ScryptHeader(const CBlockHeader& header)
+{
+    uint256 hash;
+    scrypt_1024_1_1_256(BEGIN(header.nVersion), BEGIN(hash));
+    return hash;
+}
+
+/* The PoW hash has to follow any change to the header fields, however it is computed */
+BOOST_AUTO_TEST_CASE(block_header_pow_hash)
+{
+    CBlock block = Params(CBaseChainParams::MAIN).GenesisBlock();
+    const uint256 hashGenesis = ScryptHeader(block);
+    BOOST_CHECK(block.GetPoWHash() == hashGenesis);
+    BOOST_CHECK(block.GetPoWHash() == hashGenesis);
+    BOOST_CHECK(block.GetBlockHeader().GetPoWHash() == hashGenesis);
+
+    block.nNonce++;
+    BOOST_CHECK(block.GetPoWHash() == ScryptHeader(block));
+    block.hashMerkleRoot = GetRandHash();
+    BOOST_CHECK(block.GetPoWHash() == ScryptHeader(block));
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << Params(CBaseChainParams::MAIN).GenesisBlock();
+    ss >> block;
+    BOOST_CHECK(block.GetPoWHash() == hashGenesis);
+
+    std::vector<CBlockHeader> headers(SCRYPT_MAX_WAYS + 1, block.GetBlockHeader());
+    std::vector<uint256> hashes(headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        headers[i].nNonce = i;
+    ComputePoWHashes(&headers[0], &hashes[0], headers.size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        BOOST_CHECK(hashes[i] == ScryptHeader(headers[i]));
+        BOOST_CHECK(headers[i].GetPoWHash() == hashes[i]);
+    }
+}
+
+/* Backfilled entries whose work does not check out are invalidated along with the chain above them */
+BOOST_FIXTURE_TEST_CASE(backfill_pow_hash_invalid, TestChain100Setup)
+{
+    CBlockIndex* pindexGood;
+    CBlockIndex* pindexBad;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE_EQUAL(chainActive.Height(), COINBASE_MATURITY);
+        pindexGood = chainActive[COINBASE_MATURITY / 2];
+        pindexBad = chainActive[COINBASE_MATURITY - 5];
+        BOOST_CHECK(pindexGood->nStatus & BLOCK_HAVE_POW_HASH);
+        pindexGood->nStatus &= ~BLOCK_HAVE_POW_HASH;
+        pindexGood->hashPoW.SetNull();
+        // A target no regtest header meets by accident
+        pindexBad->nStatus &= ~BLOCK_HAVE_POW_HASH;
+        pindexBad->nBits = 0x1d00ffff;
+    }
+
+    ThreadBackfillBlockIndexPoW();
+
+    LOCK(cs_main);
+    BOOST_CHECK(pindexGood->nStatus & BLOCK_HAVE_POW_HASH);
+    BOOST_CHECK(pindexGood->IsValid());
+    BOOST_CHECK(!(pindexBad->nStatus & BLOCK_HAVE_POW_HASH));
+    BOOST_CHECK(pindexBad->nStatus & BLOCK_FAILED_VALID);
+    BOOST_CHECK(chainActive.Tip() == pindexBad->pprev);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -80,6 +80,19 @@ BOOST_AUTO_TEST_CASE(rpc_rawparams)
     BOOST_CHECK_THROW(CallRPC("sendrawtransaction null"), std::runtime_error);
     BOOST_CHECK_THROW(CallRPC("sendrawtransaction DEADBEEF"), std::runtime_error);
     BOOST_CHECK_THROW(CallRPC(std::string("sendrawtransaction ")+rawtx+" extra"), std::runtime_error);
+
+    BOOST_CHECK_THROW(CallRPC("sendrawtransactions"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC("sendrawtransactions null"), std::runtime_error);
+    BOOST_CHECK_THROW(CallRPC(std::string("sendrawtransactions [\"")+rawtx+"\"] true extra"), std::runtime_error);
+    // Failures are reported per transaction rather than thrown
+    BOOST_CHECK_NO_THROW(r = CallRPC(std::string("sendrawtransactions [\"DEADBEEF\",\"")+rawtx+"\"]"));
+    BOOST_CHECK_EQUAL(r.get_array().size(), 2);
+    BOOST_CHECK(find_value(r[0].get_obj(), "txid").isNull());
+    BOOST_CHECK_EQUAL(find_value(r[0].get_obj(), "accepted").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(r[0].get_obj(), "error").get_str(), "TX decode failed");
+    BOOST_CHECK_EQUAL(find_value(r[1].get_obj(), "txid").get_str(), "a6eab3c14ab5272a58a5ba91505ba1a4b6d7a3a9fcbd187b6cd99a7b6d548cb7");
+    BOOST_CHECK_EQUAL(find_value(r[1].get_obj(), "accepted").get_bool(), false);
+    BOOST_CHECK_EQUAL(find_value(r[1].get_obj(), "error").get_str(), "Missing inputs");
 }
 
 BOOST_AUTO_TEST_CASE(rpc_togglenetwork)
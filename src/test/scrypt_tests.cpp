@@ -1,5 +1,6 @@
 #include <boost/test/unit_test.hpp>
 
+#include "test/test_random.h"
 #include "uint256.h"
 #include "util.h"
 #include "utilstrencodings.h"
@@ -32,4 +33,40 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi)
+{
+    // Test the multi-lane kernels against the generic one, including batches
+    // that don't fill all lanes
+#if defined(USE_SSE2)
+    scrypt_detect_sse2();
+#endif
+    const int nInputs = 2 * SCRYPT_MAX_WAYS + 3;
+    std::vector<char> input(80 * nInputs);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = insecure_rand();
+    std::vector<char> expected(32 * nInputs);
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    for (int i = 0; i < nInputs; i++)
+        scrypt_1024_1_1_256_sp_generic(&input[80 * i], &expected[32 * i], scratchpad);
+
+    for (int n = 1; n <= nInputs; n++) {
+        std::vector<char> output(32 * n);
+        scrypt_1024_1_1_256_multi(&input[0], &output[0], n);
+        BOOST_CHECK(std::equal(output.begin(), output.end(), expected.begin()));
+    }
+
+#if defined(USE_SSE2)
+    std::vector<char> multipad((SCRYPT_SCRATCHPAD_SIZE - 63) * SCRYPT_MAX_WAYS + 63);
+    std::vector<char> output(32 * SCRYPT_MAX_WAYS);
+    scrypt_1024_1_1_256_sp_sse2_4way(&input[0], &output[0], &multipad[0]);
+    BOOST_CHECK(std::equal(output.begin(), output.begin() + 32 * 4, expected.begin()));
+#if defined(ENABLE_AVX2)
+    if (scrypt_best_ways() == 8) {
+        scrypt_1024_1_1_256_sp_avx2_8way(&input[0], &output[0], &multipad[0]);
+        BOOST_CHECK(std::equal(output.begin(), output.begin() + 32 * 8, expected.begin()));
+    }
+#endif
+#endif
+}
+
 BOOST_AUTO_TEST_SUITE_END()
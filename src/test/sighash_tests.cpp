@@ -166,6 +166,38 @@ BOOST_AUTO_TEST_CASE(sighash_test)
     #endif
 }
 
+// Goal: check that precomputed transaction data doesn't change any signature hash
+BOOST_AUTO_TEST_CASE(sighash_precomputed)
+{
+    for (int i = 0; i < 200; i++) {
+        CMutableTransaction mtx;
+        RandomTransaction(mtx, false);
+        // Span several of the hash states kept for legacy inputs
+        int ins = insecure_rand() % 50;
+        for (int in = 0; in < ins; in++) {
+            mtx.vin.push_back(mtx.vin[insecure_rand() % mtx.vin.size()]);
+            mtx.vin.back().prevout.hash = GetRandHash();
+        }
+        if (insecure_rand() % 2) {
+            mtx.vin[insecure_rand() % mtx.vin.size()].scriptWitness.stack.push_back(std::vector<unsigned char>(1, 0));
+        }
+        const CTransaction tx(mtx);
+        const PrecomputedTransactionData txdata(tx);
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        for (unsigned int nIn = 0; nIn < tx.vin.size(); nIn++) {
+            int nHashType = insecure_rand();
+            CAmount amount = insecure_rand();
+            for (SigVersion sigversion : {SIGVERSION_BASE, SIGVERSION_WITNESS_V0}) {
+                BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, nHashType, amount, sigversion, &txdata) ==
+                            SignatureHash(scriptCode, tx, nIn, nHashType, amount, sigversion));
+                BOOST_CHECK(SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, amount, sigversion, &txdata) ==
+                            SignatureHash(scriptCode, tx, nIn, SIGHASH_ALL, amount, sigversion));
+            }
+        }
+    }
+}
+
 // Goal: check that SignatureHash generates correct hash
 BOOST_AUTO_TEST_CASE(sighash_from_data)
 {
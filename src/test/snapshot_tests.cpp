@@ -0,0 +1,128 @@
+// Copyright (c) 2017 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "coins.h"
+#include "txdb.h"
+#include "validation.h"
+#include "test/test_bitcoin.h"
+
+#include <map>
+#include <memory>
+
+#include <boost/filesystem.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(snapshot_tests, TestChain100Setup)
+
+static std::map<COutPoint, CTxOut> ReadCoins(CCoinsView* view)
+{
+    std::map<COutPoint, CTxOut> coins;
+    std::unique_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        COutPoint key;
+        Coin coin;
+        BOOST_CHECK(pcursor->GetKey(key) && pcursor->GetValue(coin));
+        coins[key] = coin.out;
+    }
+    return coins;
+}
+
+// Loads a snapshot of the test chain into a fresh chain state and compares it
+// with the original; a damaged copy, or one with another content hash than
+// expected, must be rejected before anything is written.
+BOOST_AUTO_TEST_CASE(snapshot_roundtrip)
+{
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CSnapshotInfo info;
+    BOOST_CHECK(DumpSnapshot(path, info));
+    BOOST_CHECK(info.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(info.nHeight, chainActive.Height());
+    BOOST_CHECK_EQUAL(info.nCoins, ReadCoins(pcoinsdbview).size());
+
+    CCoinsViewCache* pcoinsTipOld = pcoinsTip;
+    {
+        CCoinsViewDB db(1 << 20, true, true);
+        pcoinsTip = new CCoinsViewCache(&db);
+        BOOST_CHECK(!LoadSnapshot(path, uint256(), Params()));
+        BOOST_CHECK(db.GetBestBlock().IsNull());
+        BOOST_CHECK(LoadSnapshot(path, info.hashContent, Params()));
+        BOOST_CHECK(db.GetBestBlock() == info.hashBlock);
+        BOOST_CHECK(ReadCoins(&db) == ReadCoins(pcoinsdbview));
+        BOOST_CHECK(chainActive.Tip()->GetBlockHash() == info.hashBlock);
+        BOOST_CHECK(chainActive.Tip()->nChainTx > 0);
+        delete pcoinsTip;
+    }
+
+    boost::filesystem::path pathDamaged = pathTemp / "damaged.dat";
+    boost::filesystem::copy_file(path, pathDamaged);
+    {
+        FILE* file = fopen(pathDamaged.string().c_str(), "r+b");
+        BOOST_CHECK(file && fseek(file, -40, SEEK_END) == 0);
+        fputc(0x42, file);
+        fclose(file);
+    }
+    {
+        CCoinsViewDB db(1 << 20, true, true);
+        pcoinsTip = new CCoinsViewCache(&db);
+        BOOST_CHECK(!LoadSnapshot(pathDamaged, info.hashContent, Params()));
+        BOOST_CHECK(db.GetBestBlock().IsNull());
+        BOOST_CHECK(ReadCoins(&db).empty());
+        delete pcoinsTip;
+    }
+
+    pcoinsTip = pcoinsTipOld;
+    fHavePruned = false;
+}
+
+// The blocks below a loaded snapshot are only marked as validated once they
+// have been connected to a separate chain state that matches the snapshot.
+BOOST_AUTO_TEST_CASE(snapshot_background_validation)
+{
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CSnapshotInfo info;
+    BOOST_CHECK(DumpSnapshot(path, info));
+
+    // Forget that the blocks were connected, as on a node that only has their headers
+    {
+        LOCK(cs_main);
+        for (CBlockIndex* pindex = chainActive.Tip(); pindex->pprev; pindex = pindex->pprev)
+            pindex->nStatus = (pindex->nStatus & ~BLOCK_VALID_MASK) | BLOCK_VALID_TRANSACTIONS;
+    }
+
+    CCoinsViewCache* pcoinsTipOld = pcoinsTip;
+    {
+        CCoinsViewDB db(1 << 20, true, true);
+        pcoinsTip = new CCoinsViewCache(&db);
+        BOOST_CHECK(LoadSnapshot(path, info.hashContent, Params()));
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(pindexSnapshotBase == chainActive.Tip());
+            BOOST_CHECK(pindexSnapshotValidated == chainActive.Genesis());
+            for (CBlockIndex* pindex = chainActive.Tip(); pindex->pprev; pindex = pindex->pprev) {
+                BOOST_CHECK(pindex->nStatus & BLOCK_ASSUMED_VALID);
+                BOOST_CHECK(!pindex->IsValid(BLOCK_VALID_SCRIPTS));
+            }
+        }
+
+        BOOST_CHECK(ValidateSnapshotBlocks(Params()));
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(pindexSnapshotBase == NULL);
+            for (CBlockIndex* pindex = chainActive.Tip(); pindex->pprev; pindex = pindex->pprev) {
+                BOOST_CHECK(!(pindex->nStatus & BLOCK_ASSUMED_VALID));
+                BOOST_CHECK(pindex->IsValid(BLOCK_VALID_SCRIPTS));
+            }
+        }
+        CUTXOStats stats;
+        BOOST_CHECK(!pblocktree->ReadSnapshotStats(stats));
+        BOOST_CHECK(!boost::filesystem::exists(pathTemp / "chainstate_snapshot"));
+        delete pcoinsTip;
+    }
+
+    pcoinsTip = pcoinsTipOld;
+    fHavePruned = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -84,4 +84,68 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_prevalidate, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    // A spend of a mature coinbase, a child of that spend, and a spend of
+    // another coinbase with a signature for the wrong transaction
+    std::vector<CMutableTransaction> spends(3);
+    for (int i = 0; i < 3; i++) {
+        spends[i].nVersion = 1;
+        spends[i].vin.resize(1);
+        spends[i].vout.resize(1);
+        spends[i].vout[0].scriptPubKey = scriptPubKey;
+    }
+    spends[0].vin[0].prevout = COutPoint(coinbaseTxns[0].GetHash(), 0);
+    spends[0].vout[0].nValue = coinbaseTxns[0].vout[0].nValue - CENT;
+    spends[2].vin[0].prevout = COutPoint(coinbaseTxns[1].GetHash(), 0);
+    spends[2].vout[0].nValue = coinbaseTxns[1].vout[0].nValue - CENT;
+    for (int i = 0; i < 3; i++) {
+        if (i == 1) {
+            spends[1].vin[0].prevout = COutPoint(spends[0].GetHash(), 0);
+            spends[1].vout[0].nValue = spends[0].vout[0].nValue - CENT;
+        }
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, spends[i == 2 ? 0 : i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        spends[i].vin[0].scriptSig << vchSig;
+    }
+    std::vector<CTransactionRef> vtx;
+    for (int i = 0; i < 3; i++)
+        vtx.push_back(MakeTransactionRef(spends[i]));
+
+    // The valid chain is checked, including the child whose parent is only
+    // in the batch, and is then accepted as usual
+    BOOST_CHECK_EQUAL(PrevalidateTransactions(mempool, std::vector<CTransactionRef>(vtx.begin(), vtx.begin() + 2)), 2);
+    BOOST_CHECK(ToMemPool(spends[0]));
+    BOOST_CHECK(ToMemPool(spends[1]));
+
+    // Prevalidation doesn't let the invalid one in
+    BOOST_CHECK_EQUAL(PrevalidateTransactions(mempool, std::vector<CTransactionRef>(1, vtx[2])), 1);
+    BOOST_CHECK(!ToMemPool(spends[2]));
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    mempool.clear();
+
+    // Nor does it check the scripts of transactions that the cheap checks of
+    // AcceptToMemoryPool reject: a non-final one, and one over the absurd fee
+    std::vector<CMutableTransaction> rejected(2, spends[0]);
+    rejected[0].vin[0].nSequence = 0;
+    rejected[0].nLockTime = chainActive.Height() + 2;
+    rejected[1].vout[0].nValue -= CENT;
+    for (int i = 0; i < 2; i++) {
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, rejected[i], 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        rejected[i].vin[0].scriptSig = CScript() << vchSig;
+    }
+    CTransactionRef txNonFinal = MakeTransactionRef(rejected[0]);
+    CTransactionRef txHighFee = MakeTransactionRef(rejected[1]);
+    BOOST_CHECK_EQUAL(PrevalidateTransactions(mempool, std::vector<CTransactionRef>(1, txNonFinal)), 0);
+    BOOST_CHECK_EQUAL(PrevalidateTransactions(mempool, std::vector<CTransactionRef>(1, txHighFee), CENT), 0);
+    BOOST_CHECK_EQUAL(PrevalidateTransactions(mempool, std::vector<CTransactionRef>(1, txHighFee)), 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -9,6 +9,7 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
 #include <map>
 #include <string>
@@ -16,9 +17,11 @@
 #include <vector>
 
 #include <boost/function.hpp>
+#include <boost/thread/thread.hpp>
 
 class CBlockIndex;
 class CCoinsViewDBCursor;
+class CUTXOStats;
 class uint256;
 
 //! Compensate for extra memory peak (x1.5-x1.9) at flush time.
@@ -33,6 +36,8 @@ static const int64_t nDefaultDbCache = 450;
 static const int64_t nMaxDbCache = sizeof(void*) > 4 ? 16384 : 1024;
 //! min. -dbcache (MiB)
 static const int64_t nMinDbCache = 4;
+//! -dbcachekeep default (percent)
+static const int64_t nDefaultDbCacheKeep = 50;
 //! Max memory allocated to block tree DB specific cache, if no -txindex (MiB)
 static const int64_t nMaxBlockDBCache = 2;
 //! Max memory allocated to block tree DB specific cache, if -txindex (MiB)
@@ -41,6 +46,8 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! -backgroundflush default
+static const bool DEFAULT_BACKGROUND_FLUSH = false;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -73,13 +80,16 @@ class CCoinsViewDB : public CCoinsView
 protected:
     CDBWrapper db;
 public:
-    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false, const std::string& strName = "chainstate");
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Convert a chainstate written in the legacy per-transaction format. Returns false on error or when interrupted.
+    bool Upgrade();
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -88,22 +98,61 @@ class CCoinsViewDBCursor: public CCoinsViewCursor
 public:
     ~CCoinsViewDBCursor() {}
 
-    bool GetKey(uint256 &key) const;
-    bool GetValue(CCoins &coins) const;
+    bool GetKey(COutPoint &key) const;
+    bool GetValue(Coin &coin) const;
     unsigned int GetValueSize() const;
 
     bool Valid() const;
     void Next();
+    void Seek(const COutPoint &key);
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
         CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
     std::unique_ptr<CDBIterator> pcursor;
-    std::pair<char, uint256> keyTmp;
+    std::pair<char, COutPoint> keyTmp;
 
     friend class CCoinsViewDB;
 };
 
+/**
+ * CCoinsView that writes flushed coins to its backend on a background thread.
+ *
+ * BatchWrite takes over the flushed map and returns at once; the map is then
+ * written by a separate thread while lookups keep being answered from it, so
+ * the caller can continue validating on an empty cache. The best block marker
+ * is written in the same database batch as the coins, so after a crash the
+ * chainstate is simply at the previous flush. At most one write is in flight:
+ * a second BatchWrite waits for the first to finish.
+ */
+class CCoinsViewWriteBehind : public CCoinsViewBacked
+{
+private:
+    mutable CCriticalSection cs;
+    //! Serializes starting and joining the writer thread
+    mutable CCriticalSection csWriter;
+    //! Coins being written; only modified by the writer thread once the write succeeds
+    CCoinsMap mapWriting;
+    uint256 hashWriting;
+    bool fWriteFailed;
+    mutable boost::thread writer;
+
+    void ThreadWrite();
+
+public:
+    CCoinsViewWriteBehind(CCoinsView* viewIn);
+    ~CCoinsViewWriteBehind();
+
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
+    CCoinsViewCursor *Cursor() const;
+
+    //! Wait for the write in flight, if any. Returns false if it failed.
+    bool Sync() const;
+};
+
 /** Access to the block database (blocks/index/) */
 class CBlockTreeDB : public CDBWrapper
 {
@@ -122,6 +171,12 @@ public:
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteUTXOStats(const CUTXOStats &stats);
+    bool ReadUTXOStats(CUTXOStats &stats);
+    //! Statistics of a loaded UTXO snapshot, kept until its history has been validated
+    bool WriteSnapshotStats(const CUTXOStats &stats);
+    bool ReadSnapshotStats(CUTXOStats &stats);
+    bool EraseSnapshotStats();
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
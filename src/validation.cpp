@@ -12,6 +12,7 @@
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
 #include "policy/fees.h"
@@ -71,6 +72,7 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fCheckBlockReadPoW = DEFAULT_CHECK_BLOCK_READ_POW;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -207,7 +209,16 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewWriteBehind *pcoinsWriteBehind = NULL;
 CBlockTreeDB *pblocktree = NULL;
+CUTXOStats utxoStats;
+bool fUTXOStatsComplete = false;
+CBlockIndex *pindexSnapshotBase = NULL;
+CBlockIndex *pindexSnapshotValidated = NULL;
+
+/** The chain state on which the history below a loaded snapshot is validated (protected by cs_main) */
+static std::unique_ptr<CCoinsViewDB> pcoinsSnapshotDB;
+static std::unique_ptr<CCoinsViewCache> pcoinsSnapshot;
 
 enum FlushStateMode {
     FLUSH_STATE_NONE,
@@ -395,15 +406,15 @@ bool CheckSequenceLocks(const CTransaction &tx, int flags, LockPoints* lp, bool
         prevheights.resize(tx.vin.size());
         for (size_t txinIndex = 0; txinIndex < tx.vin.size(); txinIndex++) {
             const CTxIn& txin = tx.vin[txinIndex];
-            CCoins coins;
-            if (!viewMemPool.GetCoins(txin.prevout.hash, coins)) {
+            Coin coin;
+            if (!viewMemPool.GetCoin(txin.prevout, coin)) {
                 return error("%s: Missing input", __func__);
             }
-            if (coins.nHeight == MEMPOOL_HEIGHT) {
+            if (coin.nHeight == MEMPOOL_HEIGHT) {
                 // Assume all mempool transaction confirm in the next block
                 prevheights[txinIndex] = tip->nHeight + 1;
             } else {
-                prevheights[txinIndex] = coins.nHeight;
+                prevheights[txinIndex] = coin.nHeight;
             }
         }
         lockPair = CalculateSequenceLocks(tx, flags, &prevheights, index);
@@ -459,7 +470,9 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& in
     unsigned int nSigOps = 0;
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         if (prevout.scriptPubKey.IsPayToScriptHash())
             nSigOps += prevout.scriptPubKey.GetSigOpCount(tx.vin[i].scriptSig);
     }
@@ -479,7 +492,9 @@ int64_t GetTransactionSigOpCost(const CTransaction& tx, const CCoinsViewCache& i
 
     for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        const CTxOut &prevout = inputs.GetOutputFor(tx.vin[i]);
+        const Coin& coin = inputs.AccessCoin(tx.vin[i].prevout);
+        assert(!coin.IsSpent());
+        const CTxOut &prevout = coin.out;
         nSigOps += CountWitnessSigOps(tx.vin[i].scriptSig, prevout.scriptPubKey, &tx.vin[i].scriptWitness, flags);
     }
     return nSigOps;
@@ -543,9 +558,9 @@ void LimitMempoolSize(CTxMemPool& pool, size_t limit, unsigned long age) {
     if (expired != 0)
         LogPrint("mempool", "Expired %i transactions from the memory pool\n", expired);
 
-    std::vector<uint256> vNoSpendsRemaining;
+    std::vector<COutPoint> vNoSpendsRemaining;
     pool.TrimToSize(limit, &vNoSpendsRemaining);
-    BOOST_FOREACH(const uint256& removed, vNoSpendsRemaining)
+    BOOST_FOREACH(const COutPoint& removed, vNoSpendsRemaining)
         pcoinsTip->Uncache(removed);
 }
 
@@ -572,7 +587,7 @@ static bool IsCurrentForFeeEstimation()
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransactionRef& ptx, bool fLimitFree,
                               bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
-                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<uint256>& vHashTxnToUncache)
+                              bool fOverrideMempoolLimit, const CAmount& nAbsurdFee, std::vector<COutPoint>& coins_to_uncache)
 {
     const CTransaction& tx = *ptx;
     const uint256 hash = tx.GetHash();
@@ -665,30 +680,30 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         view.SetBackend(viewMemPool);
 
         // do we already have it?
-        bool fHadTxInCache = pcoinsTip->HaveCoinsInCache(hash);
-        if (view.HaveCoins(hash)) {
-            if (!fHadTxInCache)
-                vHashTxnToUncache.push_back(hash);
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        for (size_t out = 0; out < tx.vout.size(); out++) {
+            COutPoint outpoint(hash, out);
+            bool had_coin_in_cache = pcoinsTip->HaveCoinInCache(outpoint);
+            if (view.HaveCoin(outpoint)) {
+                if (!had_coin_in_cache) {
+                    coins_to_uncache.push_back(outpoint);
+                }
+                return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+            }
         }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         BOOST_FOREACH(const CTxIn txin, tx.vin) {
-            if (!pcoinsTip->HaveCoinsInCache(txin.prevout.hash))
-                vHashTxnToUncache.push_back(txin.prevout.hash);
-            if (!view.HaveCoins(txin.prevout.hash)) {
-                if (pfMissingInputs)
+            if (!pcoinsTip->HaveCoinInCache(txin.prevout)) {
+                coins_to_uncache.push_back(txin.prevout);
+            }
+            if (!view.HaveCoin(txin.prevout)) {
+                if (pfMissingInputs) {
                     *pfMissingInputs = true;
+                }
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
             }
         }
 
-        // are the actual inputs available?
-        if (!view.HaveInputs(tx))
-            return state.Invalid(false, REJECT_DUPLICATE, "bad-txns-inputs-spent");
-
         // Bring the best block into scope
         view.GetBestBlock();
 
@@ -730,8 +745,8 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1016,10 +1031,10 @@ bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced,
                         bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
-    std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    std::vector<COutPoint> coins_to_uncache;
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, plTxnReplaced, fOverrideMempoolLimit, nAbsurdFee, coins_to_uncache);
     if (!res) {
-        BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
+        BOOST_FOREACH(const COutPoint& hashTx, coins_to_uncache)
             pcoinsTip->Uncache(hashTx);
     }
     // After we've (potentially) uncached entries, ensure our coins cache is still within its size limits
@@ -1071,15 +1086,8 @@ bool GetTransaction(const uint256 &hash, CTransactionRef &txOut, const Consensus
     }
 
     if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-        int nHeight = -1;
-        {
-            const CCoinsViewCache& view = *pcoinsTip;
-            const CCoins* coins = view.AccessCoins(hash);
-            if (coins)
-                nHeight = coins->nHeight;
-        }
-        if (nHeight > 0)
-            pindexSlow = chainActive[nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+        if (!coin.IsSpent()) pindexSlow = chainActive[coin.nHeight];
     }
 
     if (pindexSlow) {
@@ -1129,7 +1137,7 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
-bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+static bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams, bool fCheckPoW)
 {
     block.SetNull();
 
@@ -1154,15 +1162,24 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     // std::cout << "Done!" << std::endl;
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (fCheckPoW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
 }
 
+bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
+{
+    return ReadBlockFromDisk(block, pos, consensusParams, true);
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams)
 {
-    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams))
+    // The work of an index entry with a stored PoW hash was checked against that hash when
+    // its header was accepted or the index was loaded. If the block we read has the same
+    // (SHA256) hash as the entry it is that header, so there is no need to run scrypt again.
+    const bool fTrustPoW = !fCheckBlockReadPoW && (pindex->nStatus & BLOCK_HAVE_POW_HASH);
+    if (!ReadBlockFromDisk(block, pindex->GetBlockPos(), consensusParams, !fTrustPoW))
         return false;
     if (block.GetHash() != pindex->GetBlockHash())
         return error("ReadBlockFromDisk(CBlock&, CBlockIndex*): GetHash() doesn't match index for %s at %s",
@@ -1170,6 +1187,14 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+/** The stored PoW hash of pindex, if block is its block and the hash may be used in place of running scrypt */
+static const uint256* GetTrustedPoWHash(const CBlock& block, const CBlockIndex* pindex)
+{
+    if (fCheckBlockReadPoW || !(pindex->nStatus & BLOCK_HAVE_POW_HASH) || !pindex->phashBlock || block.GetHash() != *pindex->phashBlock)
+        return NULL;
+    return &pindex->hashPoW;
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -1337,24 +1362,13 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         BOOST_FOREACH(const CTxIn &txin, tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
-            // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(!txundo.vprevout.back().IsSpent());
         }
     }
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash(), tx.IsCoinBase())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -1392,20 +1406,20 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
             // If prev is coinbase, check that it's matured
-            if (coins->IsCoinBase()) {
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY)
+            if (coin.IsCoinBase()) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY)
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -1447,11 +1461,11 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -1463,7 +1477,7 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -1558,42 +1572,46 @@ bool AbortNode(CValidationState& state, const std::string& strMessage, const std
     return state.Error(strMessage);
 }
 
+/** Abort because the block chain below a loaded UTXO snapshot does not match it */
+bool AbortSnapshotInvalid(CValidationState& state, const std::string& strMessage)
+{
+    return AbortNode(state, strMessage, _("Error: The UTXO snapshot is invalid. Restart with -reindex, without -loadsnapshot, to download and validate the block chain from the beginning."));
+}
+
 } // anon namespace
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
  * @return True on success.
  */
-bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+bool ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
+    if (view.HaveCoin(out))
+        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+        } else {
             fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+        }
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, std::move(undo), !fClean);
 
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CUTXOStats* pstats)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -1616,36 +1634,33 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = *(block.vtx[i]);
         uint256 hash = tx.GetHash();
+        bool fCoinBase = tx.IsCoinBase();
 
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                view.SpendCoin(out, &coin);
+                if (coin.IsSpent() || tx.vout[o] != coin.out || coin.nHeight != (uint32_t)pindex->nHeight || coin.IsCoinBase() != fCoinBase)
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                if (pstats && !coin.IsSpent())
+                    pstats->RemoveCoin(out, coin);
+            }
         }
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size())
                 return error("DisconnectBlock(): transaction and undo data inconsistent");
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
+                if (!ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out))
                     fClean = false;
+                if (pstats)
+                    pstats->AddCoin(out, view.AccessCoin(out));
             }
         }
     }
@@ -1693,6 +1708,250 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/** Ancestors of a transaction checked by PrevalidateTransactions */
+struct PrevalidatedAncestry
+{
+    CTxMemPool::setEntries setMempoolAncestors;
+    std::set<uint256> setBatchAncestors;
+    size_t nSize;
+};
+
+/**
+ * Collect the ancestors of entry in the mempool and among the transactions
+ * of the batch checked before it, and hold them to the mempool's ancestor
+ * and descendant limits as if those transactions had been accepted already.
+ * mapBatchDescendants has the count and size of the descendants that the
+ * batch adds to each ancestor so far.
+ */
+static bool CheckBatchAncestry(CTxMemPool& pool, const CTxMemPoolEntry& entry, const std::map<uint256, PrevalidatedAncestry>& mapBatch,
+                               const std::map<uint256, std::pair<uint64_t, uint64_t> >& mapBatchDescendants, PrevalidatedAncestry& ancestry)
+{
+    AssertLockHeld(pool.cs);
+    const uint64_t nNoLimit = std::numeric_limits<uint64_t>::max();
+    std::string dummy;
+    pool.CalculateMemPoolAncestors(entry, ancestry.setMempoolAncestors, nNoLimit, nNoLimit, nNoLimit, nNoLimit, dummy);
+    BOOST_FOREACH(const CTxIn& txin, entry.GetTx().vin) {
+        std::map<uint256, PrevalidatedAncestry>::const_iterator it = mapBatch.find(txin.prevout.hash);
+        if (it == mapBatch.end())
+            continue;
+        ancestry.setBatchAncestors.insert(it->first);
+        ancestry.setBatchAncestors.insert(it->second.setBatchAncestors.begin(), it->second.setBatchAncestors.end());
+        ancestry.setMempoolAncestors.insert(it->second.setMempoolAncestors.begin(), it->second.setMempoolAncestors.end());
+    }
+
+    uint64_t nLimitAncestors = GetArg("-limitancestorcount", DEFAULT_ANCESTOR_LIMIT);
+    uint64_t nLimitAncestorSize = GetArg("-limitancestorsize", DEFAULT_ANCESTOR_SIZE_LIMIT)*1000;
+    uint64_t nLimitDescendants = GetArg("-limitdescendantcount", DEFAULT_DESCENDANT_LIMIT);
+    uint64_t nLimitDescendantSize = GetArg("-limitdescendantsize", DEFAULT_DESCENDANT_SIZE_LIMIT)*1000;
+    if (ancestry.setMempoolAncestors.size() + ancestry.setBatchAncestors.size() + 1 > nLimitAncestors)
+        return false;
+
+    uint64_t nAncestorSize = ancestry.nSize;
+    BOOST_FOREACH(CTxMemPool::txiter it, ancestry.setMempoolAncestors) {
+        uint64_t nCountWithDescendants = it->GetCountWithDescendants();
+        uint64_t nSizeWithDescendants = it->GetSizeWithDescendants();
+        std::map<uint256, std::pair<uint64_t, uint64_t> >::const_iterator itAdded = mapBatchDescendants.find(it->GetTx().GetHash());
+        if (itAdded != mapBatchDescendants.end()) {
+            nCountWithDescendants += itAdded->second.first;
+            nSizeWithDescendants += itAdded->second.second;
+        }
+        if (nCountWithDescendants + 1 > nLimitDescendants || nSizeWithDescendants + ancestry.nSize > nLimitDescendantSize)
+            return false;
+        nAncestorSize += it->GetTxSize();
+    }
+    BOOST_FOREACH(const uint256& hash, ancestry.setBatchAncestors) {
+        uint64_t nCountWithDescendants = 1;
+        uint64_t nSizeWithDescendants = mapBatch.find(hash)->second.nSize;
+        nAncestorSize += nSizeWithDescendants;
+        std::map<uint256, std::pair<uint64_t, uint64_t> >::const_iterator itAdded = mapBatchDescendants.find(hash);
+        if (itAdded != mapBatchDescendants.end()) {
+            nCountWithDescendants += itAdded->second.first;
+            nSizeWithDescendants += itAdded->second.second;
+        }
+        if (nCountWithDescendants + 1 > nLimitDescendants || nSizeWithDescendants + ancestry.nSize > nLimitDescendantSize)
+            return false;
+    }
+    return nAncestorSize <= nLimitAncestorSize;
+}
+
+size_t PrevalidateTransactions(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, CAmount nAbsurdFee)
+{
+    if (!nScriptCheckThreads || vtx.empty())
+        return 0;
+
+    int64_t nTimeStart = GetTimeMicros();
+    std::vector<CTransactionRef> vCandidates;
+    for (const CTransactionRef& ptx : vtx) {
+        CValidationState state;
+        if (!ptx->IsCoinBase() && CheckTransaction(*ptx, state))
+            vCandidates.push_back(ptx);
+    }
+
+    // Copy the inputs of each transaction from a snapshot of the chainstate
+    // and the mempool into its script checks, skipping transactions that the
+    // cheap checks in AcceptToMemoryPool would reject before verifying any
+    // scripts. Outputs of earlier transactions in the batch can be spent by
+    // later ones, so a chain of new transactions is checked in one go.
+    std::vector<PrecomputedTransactionData> txdata;
+    txdata.reserve(vCandidates.size());
+    std::vector<CScriptCheck> vChecks;
+    std::vector<COutPoint> vUncache;
+    {
+        LOCK2(cs_main, pool.cs);
+        CCoinsView dummy;
+        CCoinsViewCache view(&dummy);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
+        view.SetBackend(viewMemPool);
+        view.GetBestBlock();
+
+        const bool witnessEnabled = IsWitnessEnabled(chainActive.Tip(), Params().GetConsensus());
+        unsigned int scriptVerifyFlags = STANDARD_SCRIPT_VERIFY_FLAGS;
+        if (!Params().RequireStandard()) {
+            scriptVerifyFlags = GetArg("-promiscuousmempoolflags", scriptVerifyFlags);
+        }
+        CFeeRate minFeeRate = std::max(pool.GetMinFee(GetArg("-maxmempool", DEFAULT_MAX_MEMPOOL_SIZE) * 1000000), ::minRelayTxFee);
+        const int nNextHeight = chainActive.Height() + 1;
+        CBlockIndex indexNext;
+        indexNext.pprev = chainActive.Tip();
+        indexNext.nHeight = nNextHeight;
+        std::map<uint256, PrevalidatedAncestry> mapBatch;
+        std::map<uint256, std::pair<uint64_t, uint64_t> > mapBatchDescendants;
+
+        for (const CTransactionRef& ptx : vCandidates) {
+            const CTransaction& tx = *ptx;
+            std::string reason;
+            if (pool.exists(tx.GetHash()) ||
+                (tx.HasWitness() && !witnessEnabled) ||
+                (fRequireStandard && !IsStandardTx(tx, reason, witnessEnabled)) ||
+                !CheckFinalTx(tx, STANDARD_LOCKTIME_VERIFY_FLAGS))
+                continue;
+
+            // Replacements and orphans are left to AcceptToMemoryPool
+            size_t nUncacheBegin = vUncache.size();
+            bool fInputsKnown = true;
+            for (const CTxIn& txin : tx.vin) {
+                if (pool.mapNextTx.count(txin.prevout)) {
+                    fInputsKnown = false;
+                    break;
+                }
+                if (!pcoinsTip->HaveCoinInCache(txin.prevout))
+                    vUncache.push_back(txin.prevout);
+                if (!view.HaveCoin(txin.prevout)) {
+                    fInputsKnown = false;
+                    break;
+                }
+            }
+
+            bool fCheck = fInputsKnown && !(fRequireStandard && !AreInputsStandard(tx, view)) &&
+                          !(tx.HasWitness() && fRequireStandard && !IsWitnessStandard(tx, view));
+            if (fCheck) {
+                // Outputs of the batch are at the next height, like those of
+                // the mempool in CheckSequenceLocks
+                std::vector<int> prevheights(tx.vin.size());
+                for (size_t i = 0; i < tx.vin.size(); i++) {
+                    const Coin& coin = view.AccessCoin(tx.vin[i].prevout);
+                    prevheights[i] = coin.nHeight == MEMPOOL_HEIGHT ? nNextHeight : coin.nHeight;
+                }
+                fCheck = SequenceLocks(tx, STANDARD_LOCKTIME_VERIFY_FLAGS, &prevheights, indexNext);
+            }
+            PrevalidatedAncestry ancestry;
+            if (fCheck) {
+                int64_t nSigOpsCost = GetTransactionSigOpCost(tx, view, STANDARD_SCRIPT_VERIFY_FLAGS);
+                CAmount nFees = view.GetValueIn(tx) - tx.GetValueOut();
+                CAmount nModifiedFees = nFees;
+                double nPriorityDummy = 0;
+                pool.ApplyDeltas(tx.GetHash(), nPriorityDummy, nModifiedFees);
+                CTxMemPoolEntry entry(ptx, nFees, 0, 0, chainActive.Height(), 0, false, nSigOpsCost, LockPoints());
+                ancestry.nSize = entry.GetTxSize();
+                fCheck = nSigOpsCost <= MAX_STANDARD_TX_SIGOPS_COST &&
+                         nModifiedFees >= minFeeRate.GetFee(ancestry.nSize) &&
+                         !(nAbsurdFee && nFees > nAbsurdFee) &&
+                         CheckBatchAncestry(pool, entry, mapBatch, mapBatchDescendants, ancestry);
+            }
+            CValidationState state;
+            if (fCheck) {
+                txdata.emplace_back(tx);
+                fCheck = CheckInputs(tx, state, view, true, scriptVerifyFlags, true, txdata.back(), &vChecks);
+            }
+            if (!fCheck) {
+                for (size_t i = nUncacheBegin; i < vUncache.size(); i++)
+                    pcoinsTip->Uncache(vUncache[i]);
+                vUncache.resize(nUncacheBegin);
+                continue;
+            }
+            UpdateCoins(tx, view, nNextHeight);
+            BOOST_FOREACH(CTxMemPool::txiter it, ancestry.setMempoolAncestors) {
+                std::pair<uint64_t, uint64_t>& added = mapBatchDescendants[it->GetTx().GetHash()];
+                added.first++;
+                added.second += ancestry.nSize;
+            }
+            BOOST_FOREACH(const uint256& hash, ancestry.setBatchAncestors) {
+                std::pair<uint64_t, uint64_t>& added = mapBatchDescendants[hash];
+                added.first++;
+                added.second += ancestry.nSize;
+            }
+            mapBatch[tx.GetHash()] = ancestry;
+        }
+    }
+
+    // Without cs_main, the signatures are verified while blocks connect and
+    // other transactions are accepted; valid ones are stored in the signature
+    // cache. The queue stops at the first invalid script, so a batch with an
+    // invalid transaction may leave later signatures to AcceptToMemoryPool.
+    size_t nChecks = vChecks.size();
+    bool fAllValid;
+    {
+        CCheckQueueControl<CScriptCheck> control(&scriptcheckqueue);
+        control.Add(vChecks);
+        fAllValid = control.Wait();
+    }
+    if (!fAllValid && !vUncache.empty()) {
+        // Don't let invalid transactions fill the coins cache
+        LOCK(cs_main);
+        BOOST_FOREACH(const COutPoint& outpoint, vUncache)
+            pcoinsTip->Uncache(outpoint);
+    }
+    LogPrint("bench", "Prevalidated %u of %u transactions (%u scripts): %.2fms\n", txdata.size(), vtx.size(), nChecks, 0.001 * (GetTimeMicros() - nTimeStart));
+    return txdata.size();
+}
+
+/**
+ * Closure reading one coin from the view below pcoinsTip, on behalf of
+ * PrefetchInputs. That view ends in the chainstate database, which is safe
+ * to read from several threads at once.
+ */
+class CCoinPrefetch
+{
+private:
+    const CCoinsView *view;
+    COutPoint outpoint;
+    Coin *coin;
+
+public:
+    CCoinPrefetch() : view(NULL), coin(NULL) {}
+    CCoinPrefetch(const CCoinsView *viewIn, const COutPoint &outpointIn, Coin *coinIn) :
+        view(viewIn), outpoint(outpointIn), coin(coinIn) {}
+
+    bool operator()() {
+        view->GetCoin(outpoint, *coin);
+        return true;
+    }
+
+    void swap(CCoinPrefetch &fetch) {
+        std::swap(view, fetch.view);
+        std::swap(outpoint, fetch.outpoint);
+        std::swap(coin, fetch.coin);
+    }
+};
+
+// Reads are dominated by disk latency, so hand them out in small batches
+static CCheckQueue<CCoinPrefetch> prefetchqueue(16);
+
+void ThreadPrefetchInputs() {
+    RenameThread("bitcoin-prefetch");
+    prefetchqueue.Thread();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -1740,21 +1999,67 @@ static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
+static int64_t nTimePrefetch = 0;
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/**
+ * Load the coins spent by a block into pcoinsTip before it is connected.
+ * Inputs missing from the cache are read from the database on the prefetch
+ * threads, so that their disk reads overlap instead of being done one by one
+ * as ConnectBlock reaches them.
+ */
+static void PrefetchInputs(const CBlock& block)
+{
+    int64_t nTimeStart = GetTimeMicros();
+
+    std::set<uint256> setBlockTxids;
+    for (const auto& tx : block.vtx) {
+        setBlockTxids.insert(tx->GetHash());
+    }
+    std::vector<COutPoint> vMissing;
+    for (const auto& tx : block.vtx) {
+        if (tx->IsCoinBase())
+            continue;
+        for (const CTxIn& txin : tx->vin) {
+            if (!setBlockTxids.count(txin.prevout.hash) && !pcoinsTip->HaveCoinInCache(txin.prevout))
+                vMissing.push_back(txin.prevout);
+        }
+    }
+    if (vMissing.empty())
+        return;
+
+    std::vector<Coin> vCoins(vMissing.size());
+    std::vector<CCoinPrefetch> vFetches;
+    vFetches.reserve(vMissing.size());
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        vFetches.push_back(CCoinPrefetch(pcoinsTip->GetBackend(), vMissing[i], &vCoins[i]));
+    }
+    CCheckQueueControl<CCoinPrefetch> control(&prefetchqueue);
+    control.Add(vFetches);
+    control.Wait();
+
+    for (size_t i = 0; i < vMissing.size(); i++) {
+        if (!vCoins[i].IsSpent())
+            pcoinsTip->CacheCoin(vMissing[i], std::move(vCoins[i]));
+    }
+
+    int64_t nTimeEnd = GetTimeMicros(); nTimePrefetch += nTimeEnd - nTimeStart;
+    LogPrint("bench", "      - Prefetch %u inputs: %.2fms [%.2fs]\n", (unsigned)vMissing.size(), 0.001 * (nTimeEnd - nTimeStart), nTimePrefetch * 0.000001);
+}
+
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CUTXOStats* pstats)
 {
     AssertLockHeld(cs_main);
 
     int64_t nTimeStart = GetTimeMicros();
 
     // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck))
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), !fJustCheck, !fJustCheck, GetTrustedPoWHash(block, pindex)))
         return error("%s: Consensus::CheckBlock: %s", __func__, FormatStateMessage(state));
 
     // verify that the view's current state corresponds to the previous block
@@ -1827,10 +2132,12 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     if (fEnforceBIP30) {
         for (const auto& tx : block.vtx) {
-            const CCoins* coins = view.AccessCoins(tx->GetHash());
-            if (coins && !coins->IsPruned())
-                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                 REJECT_INVALID, "bad-txns-BIP30");
+            for (size_t o = 0; o < tx->vout.size(); o++) {
+                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
+                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                     REJECT_INVALID, "bad-txns-BIP30");
+                }
+            }
         }
     }
 
@@ -1866,6 +2173,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
+    // Only worthwhile with worker threads, and only for views on top of
+    // pcoinsTip, whose backing view is the one safe to read concurrently.
+    if (nScriptCheckThreads && view.GetBackend() == pcoinsTip)
+        PrefetchInputs(block);
+
     CBlockUndo blockundo;
 
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
@@ -1897,7 +2209,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // be in ConnectBlock because they require the UTXO set
             prevheights.resize(tx.vin.size());
             for (size_t j = 0; j < tx.vin.size(); j++) {
-                prevheights[j] = view.AccessCoins(tx.vin[j].prevout.hash)->nHeight;
+                prevheights[j] = view.AccessCoin(tx.vin[j].prevout).nHeight;
             }
 
             if (!SequenceLocks(tx, nLockTimeFlags, &prevheights, *pindex)) {
@@ -1978,6 +2290,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (pstats) {
+        for (unsigned int i = 0; i < block.vtx.size(); i++) {
+            const CTransaction &tx = *(block.vtx[i]);
+            if (i > 0) {
+                for (size_t j = 0; j < tx.vin.size(); j++)
+                    pstats->RemoveCoin(tx.vin[j].prevout, blockundo.vtxundo[i-1].vprevout[j]);
+            }
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                if (!tx.vout[o].scriptPubKey.IsUnspendable())
+                    pstats->AddCoin(COutPoint(tx.GetHash(), o), Coin(tx.vout[o], pindex->nHeight, i == 0));
+            }
+        }
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2084,15 +2410,33 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode, int n
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
-        // Flush the chainstate (which may refer to block index entries).
-        if (!pcoinsTip->Flush())
+        // Record the UTXO set statistics of the state being flushed. They
+        // are only used on startup if the chain state ends up at the same block.
+        if (fUTXOStatsComplete && !pblocktree->WriteUTXOStats(utxoStats))
+            return AbortNode(state, "Failed to write to block index database");
+        if (pcoinsSnapshot && !pcoinsSnapshot->Flush())
+            return AbortNode(state, "Failed to write to snapshot validation database");
+        // Flush the chainstate (which may refer to block index entries),
+        // keeping recently used coins cached unless we are shutting down.
+        int64_t nKeepPercent = std::max<int64_t>(0, std::min<int64_t>(100, GetArg("-dbcachekeep", nDefaultDbCacheKeep)));
+        if (nKeepPercent > 0 && !ShutdownRequested()) {
+            if (!pcoinsTip->PartialFlush(nTotalSpace / DB_PEAK_USAGE_FACTOR * nKeepPercent / 100))
+                return AbortNode(state, "Failed to write to coin database");
+            LogPrint("coindb", "Kept %u coins (%.1fMiB) cached after flush\n", pcoinsTip->GetCacheSize(), pcoinsTip->DynamicMemoryUsage() * (1.0 / (1<<20)));
+        } else if (!pcoinsTip->Flush()) {
+            return AbortNode(state, "Failed to write to coin database");
+        }
+        // With a background writer the flush is still in progress. Wait for it
+        // when the caller needs the state on disk now, or when block files are
+        // being pruned and the chainstate can no longer lag behind them.
+        if (pcoinsWriteBehind && (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) && !pcoinsWriteBehind->Sync())
             return AbortNode(state, "Failed to write to coin database");
         nLastFlush = nNow;
     }
@@ -2194,10 +2538,13 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CUTXOStats statsDelta;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, &statsDelta))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         bool flushed = view.Flush();
         assert(flushed);
+        utxoStats += statsDelta;
+        utxoStats.hashBlock = pindexDelete->pprev->GetBlockHash();
     }
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
@@ -2241,6 +2588,93 @@ static int64_t nTimeFlush = 0;
 static int64_t nTimeChainState = 0;
 static int64_t nTimePostConnect = 0;
 
+/**
+ * Reads the next block to connect from disk and runs the context-free
+ * CheckBlock on it (computing its transaction hashes and merkle root) on a
+ * background thread, while the current block connects.
+ */
+class CBlockPreparer
+{
+private:
+    boost::thread thread;
+    //! The block being prepared, and where to read it
+    uint256 hashBlock;
+    CDiskBlockPos pos;
+    bool fTrustPoW;
+    uint256 hashPoW;
+    //! The checked block, if preparing it succeeded
+    std::shared_ptr<const CBlock> pblock;
+    //! Number of prepared blocks handed out by Get
+    uint64_t nBlocksUsed;
+
+    void ThreadPrepare(const Consensus::Params& consensusParams)
+    {
+        RenameThread("bitcoin-blkprep");
+        std::shared_ptr<CBlock> pblockNew = std::make_shared<CBlock>();
+        if (!ReadBlockFromDisk(*pblockNew, pos, consensusParams, !fTrustPoW) || pblockNew->GetHash() != hashBlock)
+            return;
+        // On failure, ConnectTip reads the block again and ConnectBlock reports why.
+        CValidationState state;
+        if (!CheckBlock(*pblockNew, state, consensusParams, true, true, fTrustPoW ? &hashPoW : NULL))
+            return;
+        pblock = pblockNew;
+    }
+
+public:
+    CBlockPreparer() : nBlocksUsed(0) {}
+
+    ~CBlockPreparer()
+    {
+        Stop();
+    }
+
+    //! Start preparing the block of pindex, which must have its data.
+    void Start(const CBlockIndex* pindex, const Consensus::Params& consensusParams)
+    {
+        AssertLockHeld(cs_main);
+        Stop();
+        hashBlock = pindex->GetBlockHash();
+        pos = pindex->GetBlockPos();
+        // See ReadBlockFromDisk(CBlock&, const CBlockIndex*, ...)
+        fTrustPoW = !fCheckBlockReadPoW && (pindex->nStatus & BLOCK_HAVE_POW_HASH);
+        hashPoW = pindex->hashPoW;
+        thread = boost::thread(boost::bind(&CBlockPreparer::ThreadPrepare, this, boost::cref(consensusParams)));
+    }
+
+    //! Wait for the preparation in flight, and return its block if it is the one of pindex and passed CheckBlock.
+    std::shared_ptr<const CBlock> Get(const CBlockIndex* pindex)
+    {
+        if (thread.joinable())
+            thread.join();
+        std::shared_ptr<const CBlock> pblockRet;
+        if (pblock && hashBlock == pindex->GetBlockHash()) {
+            pblockRet = pblock;
+            nBlocksUsed++;
+        }
+        pblock.reset();
+        return pblockRet;
+    }
+
+    uint64_t GetBlocksUsed() const { return nBlocksUsed; }
+
+    //! Wait for the preparation in flight, if any, and drop its result.
+    void Stop()
+    {
+        if (thread.joinable())
+            thread.join();
+        pblock.reset();
+    }
+};
+
+/** Prepares the next block for ActivateBestChainStep; protected by cs_main */
+static CBlockPreparer blockPreparer;
+
+uint64_t GetPreparedBlocksConnected()
+{
+    AssertLockHeld(cs_main);
+    return blockPreparer.GetBlocksUsed();
+}
+
 /**
  * Used to track blocks whose transactions were applied to the UTXO state as a
  * part of a single ActivateBestChainStep call.
@@ -2277,7 +2711,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams);
+        CUTXOStats statsDelta;
+        bool rv = ConnectBlock(blockConnecting, state, pindexNew, view, chainparams, false, &statsDelta);
         GetMainSignals().BlockChecked(blockConnecting, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2288,6 +2723,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
         LogPrint("bench", "  - Connect total: %.2fms [%.2fs]\n", (nTime3 - nTime2) * 0.001, nTimeConnectTotal * 0.000001);
         bool flushed = view.Flush();
         assert(flushed);
+        utxoStats += statsDelta;
+        utxoStats.hashBlock = pindexNew->GetBlockHash();
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
@@ -2414,7 +2851,14 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
 
         // Connect new blocks.
         BOOST_REVERSE_FOREACH(CBlockIndex *pindexConnect, vpindexToConnect) {
-            if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace)) {
+            std::shared_ptr<const CBlock> pblockConnect = (pindexConnect == pindexMostWork && pblock) ? pblock : blockPreparer.Get(pindexConnect);
+            // Read and check the next block while this one connects.
+            if (pindexConnect != pindexMostWork) {
+                CBlockIndex* pindexNext = pindexMostWork->GetAncestor(pindexConnect->nHeight + 1);
+                if ((pindexNext != pindexMostWork || !pblock) && (pindexNext->nStatus & BLOCK_HAVE_DATA))
+                    blockPreparer.Start(pindexNext, chainparams.GetConsensus());
+            }
+            if (!ConnectTip(state, chainparams, pindexConnect, pblockConnect, connectTrace)) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -2838,10 +3282,10 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     return true;
 }
 
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, const uint256* phashPoW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams)) {
+    if (fCheckPOW && !CheckProofOfWork(phashPoW ? *phashPoW : block.GetPoWHash(), block.nBits, consensusParams)) {
       printf("doS: %d\n", state.DoS(25, false, REJECT_INVALID, "high-hash", false, "proof of work failed"));
       return state.DoS(25, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
     }
@@ -2849,7 +3293,7 @@ bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const
     return true;
 }
 
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot)
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW, bool fCheckMerkleRoot, const uint256* phashPoW)
 {
     // These are checks that are independent of context.
 
@@ -2858,7 +3302,7 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
 
     // Check that the header is valid (particularly PoW).  This is mostly
     // redundant with the call in AcceptBlockHeader.
-    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
+    if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW, phashPoW))
         return false;
 
     // Check the merkle root.
@@ -3100,13 +3544,39 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex)
+/** Compute the scrypt hashes of a batch of headers, spread over nThreads threads. */
+static void GetPoWHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashes, int nThreads)
+{
+    hashes.resize(headers.size());
+
+    // Hand out as many headers at a time as the scrypt kernel hashes in parallel lanes
+    const size_t nWays = scrypt_best_ways();
+    nThreads = std::max(1, std::min<int>(nThreads, (headers.size() + nWays - 1) / nWays));
+
+    std::atomic<size_t> nNext(0);
+    auto worker = [&headers, &hashes, &nNext, nWays]() {
+        for (size_t i = nNext.fetch_add(nWays); i < headers.size(); i = nNext.fetch_add(nWays))
+            ComputePoWHashes(&headers[i], &hashes[i], std::min(nWays, headers.size() - i));
+    };
+
+    boost::thread_group workers;
+    for (int i = 1; i < nThreads; i++)
+        workers.create_thread(worker);
+    worker();
+
+    // The workers reference our stack, so they must be joined even when interrupted.
+    boost::this_thread::disable_interruption noInterrupt;
+    workers.join_all();
+}
+
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, const uint256* phashPoW = NULL)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
     uint256 hash = block.GetHash();
     BlockMap::iterator miSelf = mapBlockIndex.find(hash);
     CBlockIndex *pindex = NULL;
+    uint256 hashPoW;
     if (hash != chainparams.GetConsensus().hashGenesisBlock) {
 
         if (miSelf != mapBlockIndex.end()) {
@@ -3119,7 +3589,8 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        hashPoW = phashPoW ? *phashPoW : block.GetPoWHash();
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), true, &hashPoW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3138,8 +3609,11 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         if (!ContextualCheckBlockHeader(block, state, chainparams.GetConsensus(), pindexPrev, GetAdjustedTime()))
             return error("%s: Consensus::ContextualCheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
     }
-    if (pindex == NULL)
+    if (pindex == NULL) {
         pindex = AddToBlockIndex(block);
+        if (!(pindex->nStatus & BLOCK_HAVE_POW_HASH))
+            pindex->SetPoWHash(hashPoW.IsNull() ? block.GetPoWHash() : hashPoW);
+    }
 
     if (ppindex)
         *ppindex = pindex;
@@ -3152,24 +3626,54 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
 // Exposed wrapper for AcceptBlockHeader
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex)
 {
-    {
+    // The scrypt hashes dominate the cost of accepting headers, so they are
+    // computed in parallel without holding cs_main. Only the first header of a
+    // batch has to connect to a block we know, so to keep a peer from making
+    // us hash a long chain of worthless headers, the first one is fully
+    // checked on its own, and the others are hashed one round of the worker
+    // threads at a time, each round only after the previous one was accepted.
+    // Hashing also stops at a header that doesn't connect to its predecessor.
+    const size_t nChunk = scrypt_best_ways() * std::max(1, nScriptCheckThreads);
+    for (size_t nBegin = 0; nBegin < headers.size(); ) {
+        size_t nEnd = nBegin == 0 ? 1 : std::min(headers.size(), nBegin + nChunk);
+        std::vector<CBlockHeader> vToHash;
+        std::vector<size_t> vToHashPos;
+        if (nBegin > 0) {
+            LOCK(cs_main);
+            for (size_t i = nBegin; i < nEnd; i++) {
+                if (headers[i].hashPrevBlock != headers[i - 1].GetHash())
+                    break;
+                if (!mapBlockIndex.count(headers[i].GetHash())) {
+                    vToHash.push_back(headers[i]);
+                    vToHashPos.push_back(i);
+                }
+            }
+        }
+        std::vector<uint256> vHashPoW;
+        GetPoWHashes(vToHash, vHashPoW, nScriptCheckThreads);
+
+        std::vector<const uint256*> vpHashPoW(nEnd - nBegin, NULL);
+        for (size_t i = 0; i < vToHashPos.size(); i++)
+            vpHashPoW[vToHashPos[i] - nBegin] = &vHashPoW[i];
+
         LOCK(cs_main);
-        for (const CBlockHeader& header : headers) {
+        for (size_t i = nBegin; i < nEnd; i++) {
             CBlockIndex *pindex = NULL; // Use a temp pindex instead of ppindex to avoid a const_cast
-            if (!AcceptBlockHeader(header, state, chainparams, &pindex)) {
+            if (!AcceptBlockHeader(headers[i], state, chainparams, &pindex, vpHashPoW[i - nBegin])) {
                 return false;
             }
             if (ppindex) {
                 *ppindex = pindex;
             }
         }
+        nBegin = nEnd;
     }
     NotifyHeaderTip();
     return true;
 }
 
 /** Store block on disk. If dbp is non-NULL, the file is known to already reside on disk */
-static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock)
+static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool* fNewBlock, const uint256* phashPoW = NULL)
 {
     const CBlock& block = *pblock;
 
@@ -3179,7 +3683,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, phashPoW))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -3209,7 +3713,7 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
     }
     if (fNewBlock) *fNewBlock = true;
 
-    if (!CheckBlock(block, state, chainparams.GetConsensus()) ||
+    if (!CheckBlock(block, state, chainparams.GetConsensus(), true, true, phashPoW) ||
         !ContextualCheckBlock(block, state, chainparams.GetConsensus(), pindex->pprev)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -3218,6 +3722,10 @@ static bool AcceptBlock(const std::shared_ptr<const CBlock>& pblock, CValidation
         return error("%s: %s", __func__, FormatStateMessage(state));
     }
 
+    // The transaction count of blocks below a loaded snapshot came with the snapshot
+    if ((pindex->nStatus & BLOCK_ASSUMED_VALID) && pindex->nTx != block.vtx.size())
+        return AbortSnapshotInvalid(state, strprintf("UTXO snapshot has the wrong transaction count for block %s", pindex->GetBlockHash().ToString()));
+
     // Header is valid/has work, merkle tree and segwit merkle tree are good...RELAY NOW
     // (but if it does not build on our best tip, let the SendMessages loop relay it)
     if (!IsInitialBlockDownload() && chainActive.Tip() == pindex->pprev)
@@ -3254,16 +3762,22 @@ bool ProcessNewBlock(const CChainParams& chainparams, const std::shared_ptr<cons
         CBlockIndex *pindex = NULL;
         if (fNewBlock) *fNewBlock = false;
         CValidationState state;
+        // Hash the header once for both CheckBlock and AcceptBlockHeader, unless the
+        // block was checked already (as reconstructed compact blocks are).
+        uint256 hashPoW;
+        if (!pblock->fChecked)
+            hashPoW = pblock->GetPoWHash();
+        const uint256* phashPoW = hashPoW.IsNull() ? NULL : &hashPoW;
         // Ensure that CheckBlock() passes before calling AcceptBlock, as
         // belt-and-suspenders.
-        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus());
+        bool ret = CheckBlock(*pblock, state, chainparams.GetConsensus(), true, true, phashPoW);
         //printf("CheckBlock ret: %d\n", ret);
 
         LOCK(cs_main);
 
         if (ret) {
             // Store to disk
-            ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, NULL, fNewBlock);
+            ret = AcceptBlock(pblock, state, chainparams, &pindex, fForceProcessing, NULL, fNewBlock, phashPoW);
         }
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret) {
@@ -3365,6 +3879,14 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 }
 
 /* Calculate the block/rev files to delete based on height specified by user with RPC command pruneblockchain */
+/** Whether a block file may hold blocks that the snapshot validation has yet to read */
+static bool IsFileNeededBySnapshotValidation(int nFile)
+{
+    return pindexSnapshotBase &&
+           vinfoBlockFile[nFile].nHeightLast > (unsigned int)pindexSnapshotValidated->nHeight &&
+           vinfoBlockFile[nFile].nHeightFirst <= (unsigned int)pindexSnapshotBase->nHeight;
+}
+
 void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight)
 {
     assert(fPruneMode && nManualPruneHeight > 0);
@@ -3377,7 +3899,8 @@ void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeig
     unsigned int nLastBlockWeCanPrune = std::min((unsigned)nManualPruneHeight, chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP);
     int count=0;
     for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-        if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
+        if (vinfoBlockFile[fileNumber].nSize == 0 || vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune ||
+            IsFileNeededBySnapshotValidation(fileNumber))
             continue;
         PruneOneBlockFile(fileNumber);
         setFilesToPrune.insert(fileNumber);
@@ -3427,6 +3950,10 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
             if (vinfoBlockFile[fileNumber].nHeightLast > nLastBlockWeCanPrune)
                 continue;
 
+            // nor files with blocks still to be validated below a loaded UTXO snapshot
+            if (IsFileNeededBySnapshotValidation(fileNumber))
+                continue;
+
             PruneOneBlockFile(fileNumber);
             // Queue up the files for removal
             setFilesToPrune.insert(fileNumber);
@@ -3661,8 +4188,9 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
+        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_UNDO)) {
+            // If pruning, only go back as far as we have data. Blocks below a
+            // loaded UTXO snapshot never have undo data, even once downloaded.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
         }
@@ -3671,7 +4199,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
             return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
         // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
+        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus(), true, true, GetTrustedPoWHash(block, pindex)))
             return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
                          pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
         // check level 2: verify undo validity
@@ -3806,12 +4334,82 @@ bool RewindBlockIndex(const CChainParams& params)
     return true;
 }
 
+void ThreadBackfillBlockIndexPoW()
+{
+    RenameThread("bitcoin-powindex");
+
+    std::vector<CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        BOOST_FOREACH(const BlockMap::value_type& entry, mapBlockIndex) {
+            if (!(entry.second->nStatus & BLOCK_HAVE_POW_HASH))
+                vIndex.push_back(entry.second);
+        }
+    }
+    if (vIndex.empty())
+        return;
+
+    const int nThreads = std::max(GetNumCores(), 1);
+    LogPrintf("%s: computing proof-of-work hashes for %u block index entries using %d threads\n", __func__, vIndex.size(), nThreads);
+    int64_t nStart = GetTimeMillis();
+
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<uint256> vHashes;
+    bool fInvalidFound = false;
+    for (size_t nBegin = 0; nBegin < vIndex.size(); nBegin += POW_BACKFILL_BATCH_SIZE) {
+        boost::this_thread::interruption_point();
+        size_t nEnd = std::min(nBegin + POW_BACKFILL_BATCH_SIZE, vIndex.size());
+
+        vHeaders.clear();
+        {
+            LOCK(cs_main);
+            for (size_t i = nBegin; i < nEnd; i++)
+                vHeaders.push_back(vIndex[i]->GetBlockHeader());
+        }
+
+        GetPoWHashes(vHeaders, vHashes, nThreads);
+
+        LOCK(cs_main);
+        const Consensus::Params& consensusParams = Params().GetConsensus();
+        for (size_t i = nBegin; i < nEnd; i++) {
+            CBlockIndex* pindex = vIndex[i];
+            if (pindex->nStatus & BLOCK_HAVE_POW_HASH)
+                continue;
+            const uint256& hashPoW = vHashes[i - nBegin];
+            if (!CheckProofOfWork(hashPoW, pindex->nBits, consensusParams)) {
+                // Treat the entry (and the chain built on it) as invalid, disconnecting it if it is
+                // part of the active chain, just as invalidateblock would.
+                error("%s: CheckProofOfWork failed: %s", __func__, pindex->ToString());
+                CValidationState state;
+                if (!InvalidateBlock(state, Params(), pindex)) {
+                    AbortNode(state, "Failed to invalidate block with bad proof-of-work");
+                    return;
+                }
+                fInvalidFound = true;
+                continue;
+            }
+            pindex->SetPoWHash(hashPoW);
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
+
+    if (fInvalidFound) {
+        CValidationState state;
+        if (!ActivateBestChain(state, Params()))
+            LogPrintf("%s: ActivateBestChain failed: %s\n", __func__, FormatStateMessage(state));
+    }
+
+    LogPrintf("%s: done (%dms)\n", __func__, GetTimeMillis() - nStart);
+}
+
 // May NOT be used after any connections are up as much
 // of the peer-processing logic assumes a consistent
 // block index state
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
+    blockPreparer.Stop();
+    UnloadSnapshotValidation();
     setBlockIndexCandidates.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
@@ -3869,6 +4467,7 @@ bool InitBlockIndex(const CChainParams& chainparams)
             if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
             CBlockIndex *pindex = AddToBlockIndex(block);
+            pindex->SetPoWHash(block.GetPoWHash());
             if (!ReceivedBlockTransactions(block, state, pindex, blockPos))
                 return error("LoadBlockIndex(): genesis block not accepted");
             // Force a chainstate write so that when we VerifyDB in a moment, it doesn't check stale data
@@ -4046,8 +4645,9 @@ static void CheckBlockIndex(const Consensus::Params& consensusParams)
         if (pindexFirstNeverProcessed == NULL && pindex->nTx == 0) pindexFirstNeverProcessed = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTreeValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TREE) pindexFirstNotTreeValid = pindex;
         if (pindex->pprev != NULL && pindexFirstNotTransactionsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_TRANSACTIONS) pindexFirstNotTransactionsValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN) pindexFirstNotChainValid = pindex;
-        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS) pindexFirstNotScriptsValid = pindex;
+        // Blocks below a loaded UTXO snapshot are assumed valid until the snapshot validation reaches it.
+        if (pindex->pprev != NULL && pindexFirstNotChainValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_CHAIN && !(pindex->nStatus & BLOCK_ASSUMED_VALID)) pindexFirstNotChainValid = pindex;
+        if (pindex->pprev != NULL && pindexFirstNotScriptsValid == NULL && (pindex->nStatus & BLOCK_VALID_MASK) < BLOCK_VALID_SCRIPTS && !(pindex->nStatus & BLOCK_ASSUMED_VALID)) pindexFirstNotScriptsValid = pindex;
 
         // Begin: actual consistency checks.
         if (pindex->pprev == NULL) {
@@ -4230,32 +4830,44 @@ bool LoadMempool(void)
         uint64_t num;
         file >> num;
         double prioritydummy = 0;
-        while (num--) {
-            CTransactionRef tx;
-            int64_t nTime;
-            int64_t nFeeDelta;
-            file >> tx;
-            file >> nTime;
-            file >> nFeeDelta;
-
-            CAmount amountdelta = nFeeDelta;
-            if (amountdelta) {
-                mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), prioritydummy, amountdelta);
+        while (num) {
+            // Read the transactions in batches, so that the scripts of each
+            // batch can be verified in parallel before they are accepted
+            std::vector<CTransactionRef> vtx;
+            std::vector<int64_t> vTime;
+            for (; num && vtx.size() < 1000; num--) {
+                CTransactionRef tx;
+                int64_t nTime;
+                int64_t nFeeDelta;
+                file >> tx;
+                file >> nTime;
+                file >> nFeeDelta;
+
+                CAmount amountdelta = nFeeDelta;
+                if (amountdelta) {
+                    mempool.PrioritiseTransaction(tx->GetHash(), tx->GetHash().ToString(), prioritydummy, amountdelta);
+                }
+                if (nTime + nExpiryTimeout > nNow) {
+                    vtx.push_back(tx);
+                    vTime.push_back(nTime);
+                } else {
+                    ++skipped;
+                }
             }
-            CValidationState state;
-            if (nTime + nExpiryTimeout > nNow) {
+            PrevalidateTransactions(mempool, vtx);
+
+            for (size_t i = 0; i < vtx.size(); i++) {
+                CValidationState state;
                 LOCK(cs_main);
-                AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime);
+                AcceptToMemoryPoolWithTime(mempool, state, vtx[i], true, NULL, vTime[i]);
                 if (state.IsValid()) {
                     ++count;
                 } else {
                     ++failed;
                 }
-            } else {
-                ++skipped;
+                if (ShutdownRequested())
+                    return false;
             }
-            if (ShutdownRequested())
-                return false;
         }
         std::map<uint256, CAmount> mapDeltas;
         file >> mapDeltas;
@@ -4319,6 +4931,508 @@ void DumpMempool(void)
     }
 }
 
+bool LoadUTXOStats()
+{
+    LOCK(cs_main);
+    uint256 hashBest = pcoinsTip->GetBestBlock();
+    CUTXOStats stats;
+    if (hashBest.IsNull()) {
+        // An empty chain state has empty statistics
+        utxoStats = CUTXOStats();
+    } else if (pblocktree->ReadUTXOStats(stats) && stats.hashBlock == hashBest) {
+        utxoStats = stats;
+    } else {
+        fUTXOStatsComplete = false;
+        return false;
+    }
+    fUTXOStatsComplete = true;
+    return true;
+}
+
+/**
+ * Open cursors for a parallel walk over the UTXO set at the tip. If fRebuild,
+ * utxoStats are reset at the same point, so that afterwards they only track
+ * the changes relative to what the cursors see.
+ */
+static void OpenTipCursors(std::vector<std::unique_ptr<CCoinsViewCursor> >& cursors, CCoinsStats& stats, CUTXOStats* pmaintained, bool fRebuild)
+{
+    LOCK(cs_main);
+    // Nothing is written to the chain state database while cs_main is held
+    // after this, so all cursors see the same state.
+    FlushStateToDisk();
+    OpenUTXOStatsCursors(pcoinsTip, cursors);
+    BlockMap::iterator it = mapBlockIndex.find(cursors[0]->GetBestBlock());
+    stats.nHeight = it != mapBlockIndex.end() ? it->second->nHeight : 0;
+    if (pmaintained) {
+        *pmaintained = CUTXOStats();
+        if (fUTXOStatsComplete && utxoStats.hashBlock == cursors[0]->GetBestBlock())
+            *pmaintained = utxoStats;
+    }
+    if (fRebuild) {
+        utxoStats = CUTXOStats();
+        utxoStats.hashBlock = cursors[0]->GetBestBlock();
+        fUTXOStatsComplete = false;
+    }
+}
+
+bool GetUTXOStats(CCoinsStats& stats, CUTXOStats* pmaintained)
+{
+    std::vector<std::unique_ptr<CCoinsViewCursor> > cursors;
+    OpenTipCursors(cursors, stats, pmaintained, false);
+    return ComputeUTXOStats(cursors, stats);
+}
+
+void ThreadRebuildUTXOStats()
+{
+    RenameThread("bitcoin-utxostat");
+    int64_t nStart = GetTimeMicros();
+    LogPrintf("Rebuilding UTXO set statistics...\n");
+    std::vector<std::unique_ptr<CCoinsViewCursor> > cursors;
+    CCoinsStats stats;
+    OpenTipCursors(cursors, stats, NULL, true);
+    if (!ComputeUTXOStats(cursors, stats)) {
+        LogPrintf("Rebuilding UTXO set statistics failed or was interrupted\n");
+        return;
+    }
+    LOCK(cs_main);
+    CUTXOStats statsDelta = utxoStats;
+    utxoStats = stats.utxo;
+    utxoStats += statsDelta;
+    utxoStats.hashBlock = statsDelta.hashBlock;
+    fUTXOStatsComplete = true;
+    LogPrintf("Rebuilt UTXO set statistics at height %d: %.2fs\n", stats.nHeight, (GetTimeMicros() - nStart) * 0.000001);
+}
+
+/**
+ * UTXO set snapshots hold, in order:
+ *  - SNAPSHOT_MAGIC, SNAPSHOT_VERSION and the network's message start,
+ *  - the hash and height of the snapshot block,
+ *  - the headers from block 1 up to the snapshot block, each followed by its
+ *    transaction count,
+ *  - the coins grouped by transaction: a compact size output count (0 ends
+ *    the list), the txid, then the index and coin of each output,
+ *  - the number of coins,
+ *  - the SHA256d hash of everything above.
+ */
+static const unsigned char SNAPSHOT_MAGIC[] = {'u', 't', 'x', 'o', 0xff};
+static const uint64_t SNAPSHOT_VERSION = 1;
+
+template <typename T>
+static void WriteHashed(CAutoFile& file, CHashWriter& hasher, const T& obj)
+{
+    file << obj;
+    hasher << obj;
+}
+
+static void WriteSnapshotTx(CAutoFile& file, CHashWriter& hasher, const uint256& txid, const std::vector<std::pair<uint32_t, Coin> >& outputs)
+{
+    uint64_t nOutputs = outputs.size();
+    WriteHashed(file, hasher, COMPACTSIZE(nOutputs));
+    WriteHashed(file, hasher, txid);
+    for (const auto& output : outputs) {
+        WriteHashed(file, hasher, VARINT(output.first));
+        WriteHashed(file, hasher, output.second);
+    }
+}
+
+bool DumpSnapshot(const boost::filesystem::path& path, CSnapshotInfo& info)
+{
+    int64_t nStart = GetTimeMicros();
+
+    // Block index entries are never deleted, and their headers and
+    // transaction counts do not change once set, so they can be read
+    // without cs_main while writing.
+    std::unique_ptr<CCoinsViewCursor> pcursor;
+    std::vector<const CBlockIndex*> vIndex;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsTip->Cursor());
+        info.hashBlock = pcursor->GetBestBlock();
+        BlockMap::const_iterator it = mapBlockIndex.find(info.hashBlock);
+        if (it == mapBlockIndex.end())
+            return error("%s: chain state block %s not in the block index", __func__, info.hashBlock.ToString());
+        info.nHeight = it->second->nHeight;
+        for (const CBlockIndex* pindex = it->second; pindex->pprev; pindex = pindex->pprev)
+            vIndex.push_back(pindex);
+    }
+    if (vIndex.empty())
+        return error("%s: cannot dump the UTXO set at the genesis block", __func__);
+
+    std::string strTmp = path.string() + ".incomplete";
+    FILE* filestr = fopen(strTmp.c_str(), "wb");
+    if (!filestr)
+        return error("%s: unable to open %s", __func__, strTmp);
+    try {
+        CAutoFile file(filestr, SER_DISK, CLIENT_VERSION);
+        CHashWriter hasher(SER_DISK, CLIENT_VERSION);
+
+        WriteHashed(file, hasher, FLATDATA(SNAPSHOT_MAGIC));
+        WriteHashed(file, hasher, SNAPSHOT_VERSION);
+        WriteHashed(file, hasher, FLATDATA(Params().MessageStart()));
+        WriteHashed(file, hasher, info.hashBlock);
+        WriteHashed(file, hasher, info.nHeight);
+        for (std::vector<const CBlockIndex*>::const_reverse_iterator it = vIndex.rbegin(); it != vIndex.rend(); ++it) {
+            WriteHashed(file, hasher, (*it)->GetBlockHeader());
+            WriteHashed(file, hasher, VARINT((*it)->nTx));
+        }
+
+        // The cursor returns outputs ordered by txid
+        info.nCoins = 0;
+        uint256 prevkey;
+        std::vector<std::pair<uint32_t, Coin> > outputs;
+        for (; pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            COutPoint key;
+            Coin coin;
+            if (!pcursor->GetKey(key) || !pcursor->GetValue(coin))
+                return error("%s: unable to read coin", __func__);
+            if (!outputs.empty() && key.hash != prevkey) {
+                WriteSnapshotTx(file, hasher, prevkey, outputs);
+                outputs.clear();
+            }
+            prevkey = key.hash;
+            outputs.push_back(std::make_pair(key.n, std::move(coin)));
+            info.nCoins++;
+        }
+        if (!outputs.empty())
+            WriteSnapshotTx(file, hasher, prevkey, outputs);
+        uint64_t nEnd = 0;
+        WriteHashed(file, hasher, COMPACTSIZE(nEnd));
+        WriteHashed(file, hasher, info.nCoins);
+
+        info.hashContent = hasher.GetHash();
+        file << info.hashContent;
+        FileCommit(file.Get());
+        file.fclose();
+    } catch (const std::exception& e) {
+        return error("%s: unable to write %s: %s", __func__, strTmp, e.what());
+    }
+    if (!RenameOver(strTmp, path))
+        return error("%s: unable to rename %s", __func__, strTmp);
+
+    LogPrintf("Dumped UTXO snapshot of %u coins at height %d to %s: %.2fs\n", info.nCoins, info.nHeight, path.string(), (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+//! Read the start of a snapshot, up to and including the headers
+template <typename Stream>
+static void ReadSnapshotHeaders(Stream& s, const CChainParams& chainparams, CSnapshotInfo& info, std::vector<CBlockHeader>& vHeaders, std::vector<unsigned int>& vTx)
+{
+    unsigned char magic[sizeof(SNAPSHOT_MAGIC)];
+    uint64_t nVersion;
+    CMessageHeader::MessageStartChars messageStart;
+    s >> FLATDATA(magic) >> nVersion >> FLATDATA(messageStart);
+    if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0 || nVersion != SNAPSHOT_VERSION)
+        throw std::runtime_error("not a UTXO snapshot, or an unsupported version");
+    if (memcmp(messageStart, chainparams.MessageStart(), sizeof(messageStart)) != 0)
+        throw std::runtime_error("snapshot is for a different network");
+    s >> info.hashBlock >> info.nHeight;
+    if (info.nHeight < 1)
+        throw std::runtime_error("invalid snapshot height");
+
+    vHeaders.clear();
+    vTx.clear();
+    for (int i = 0; i < info.nHeight; i++) {
+        CBlockHeader header;
+        unsigned int nTx;
+        s >> header >> VARINT(nTx);
+        if (nTx == 0)
+            throw std::runtime_error("invalid transaction count");
+        vHeaders.push_back(header);
+        vTx.push_back(nTx);
+    }
+}
+
+//! Read the coins of a snapshot, passing each to fn, and return how many there were
+template <typename Stream, typename Callback>
+static uint64_t ReadSnapshotCoins(Stream& s, Callback fn)
+{
+    uint64_t nCoins = 0;
+    while (true) {
+        uint64_t nOutputs;
+        s >> COMPACTSIZE(nOutputs);
+        if (nOutputs == 0)
+            break;
+        uint256 txid;
+        s >> txid;
+        for (uint64_t i = 0; i < nOutputs; i++) {
+            uint32_t n;
+            Coin coin;
+            s >> VARINT(n) >> coin;
+            fn(COutPoint(txid, n), std::move(coin));
+            nCoins++;
+        }
+    }
+    return nCoins;
+}
+
+//! Directory of the chain state the history below a loaded snapshot is validated on
+static const char* const SNAPSHOT_CHAINSTATE_DIR = "chainstate_snapshot";
+
+static void OpenSnapshotValidation(bool fWipe)
+{
+    AssertLockHeld(cs_main);
+    pcoinsSnapshotDB.reset(new CCoinsViewDB(nMaxCoinsDBCache << 20, false, fWipe, SNAPSHOT_CHAINSTATE_DIR));
+    pcoinsSnapshot.reset(new CCoinsViewCache(pcoinsSnapshotDB.get()));
+}
+
+void UnloadSnapshotValidation()
+{
+    LOCK(cs_main);
+    pcoinsSnapshot.reset();
+    pcoinsSnapshotDB.reset();
+    pindexSnapshotBase = NULL;
+    pindexSnapshotValidated = NULL;
+}
+
+bool LoadSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, const CChainParams& chainparams)
+{
+    if (!pcoinsTip->GetBestBlock().IsNull()) {
+        LogPrintf("Ignoring -loadsnapshot: the chain state is not empty\n");
+        return true;
+    }
+    int64_t nStart = GetTimeMicros();
+
+    // First pass: verify the content hash before anything is written
+    CSnapshotInfo info;
+    std::vector<CBlockHeader> vHeaders;
+    std::vector<unsigned int> vTx;
+    try {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: unable to open %s", __func__, path.string());
+        CHashVerifier<CAutoFile> verifier(&filein);
+        ReadSnapshotHeaders(verifier, chainparams, info, vHeaders, vTx);
+        uint64_t nCoins = ReadSnapshotCoins(verifier, [](const COutPoint&, Coin&&) {});
+        verifier >> info.nCoins;
+        info.hashContent = verifier.GetHash();
+        uint256 hashStored;
+        filein >> hashStored;
+        if (nCoins != info.nCoins || hashStored != info.hashContent)
+            return error("%s: %s is corrupted", __func__, path.string());
+    } catch (const std::exception& e) {
+        return error("%s: unable to read %s: %s", __func__, path.string(), e.what());
+    }
+    if (info.hashContent != hashExpected)
+        return error("%s: %s has content hash %s, expected %s", __func__, path.string(), info.hashContent.ToString(), hashExpected.ToString());
+    if (vHeaders.front().hashPrevBlock != chainparams.GetConsensus().hashGenesisBlock || vHeaders.back().GetHash() != info.hashBlock)
+        return error("%s: the snapshot headers do not lead from the genesis block to the snapshot block", __func__);
+    LogPrintf("Loading UTXO snapshot of %u coins at height %d, block %s, content hash %s\n", info.nCoins, info.nHeight, info.hashBlock.ToString(), info.hashContent.ToString());
+
+    // The headers are checked exactly as during headers sync, which starts
+    // with the genesis block connected.
+    {
+        LOCK(cs_main);
+        if (chainActive.Tip() == NULL)
+            chainActive.SetTip(mapBlockIndex[chainparams.GetConsensus().hashGenesisBlock]);
+    }
+    for (size_t i = 0; i < vHeaders.size(); i += MAX_HEADERS_RESULTS) {
+        if (ShutdownRequested())
+            return false;
+        std::vector<CBlockHeader> vChunk(vHeaders.begin() + i, vHeaders.begin() + std::min(vHeaders.size(), i + MAX_HEADERS_RESULTS));
+        CValidationState state;
+        if (!ProcessNewBlockHeaders(vChunk, state, chainparams))
+            return error("%s: invalid header in snapshot: %s", __func__, FormatStateMessage(state));
+    }
+
+    // Second pass: load the coins in batches as large as the coins cache.
+    // The best block is only written with the last one; until the block
+    // index is updated too, a flag marks the chain state as incomplete.
+    // The statistics of the coins are kept to check the snapshot against
+    // once the blocks below it have been validated.
+    CUTXOStats statsSnapshot;
+    pblocktree->WriteFlag("loadingsnapshot", true);
+    try {
+        CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("%s: unable to open %s", __func__, path.string());
+        ReadSnapshotHeaders(filein, chainparams, info, vHeaders, vTx);
+        LOCK(cs_main);
+        ReadSnapshotCoins(filein, [&statsSnapshot](const COutPoint& outpoint, Coin&& coin) {
+            statsSnapshot.AddCoin(outpoint, coin);
+            pcoinsTip->AddCoin(outpoint, std::move(coin), false);
+            if (pcoinsTip->DynamicMemoryUsage() > nCoinCacheUsage && !pcoinsTip->Flush())
+                throw std::runtime_error("failed to write to coin database");
+        });
+        pcoinsTip->SetBestBlock(info.hashBlock);
+        if (!pcoinsTip->Flush())
+            throw std::runtime_error("failed to write to coin database");
+    } catch (const std::exception& e) {
+        return error("%s: unable to load %s: %s", __func__, path.string(), e.what());
+    }
+
+    // Mark the history below the snapshot as assumed valid and already
+    // pruned. It is downloaded and validated from the genesis block on a
+    // separate chain state in the background, see ValidateSnapshotBlocks.
+    {
+        LOCK(cs_main);
+        BlockMap::iterator it = mapBlockIndex.find(info.hashBlock);
+        assert(it != mapBlockIndex.end());
+        CBlockIndex* pindexBase = it->second;
+        for (int nHeight = 1; nHeight <= info.nHeight; nHeight++) {
+            CBlockIndex* pindex = pindexBase->GetAncestor(nHeight);
+            pindex->nTx = vTx[nHeight - 1];
+            pindex->nChainTx = pindex->pprev->nChainTx + pindex->nTx;
+            if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus()))
+                pindex->nStatus |= BLOCK_OPT_WITNESS;
+            if (!pindex->IsValid(BLOCK_VALID_SCRIPTS)) {
+                pindex->RaiseValidity(BLOCK_VALID_TRANSACTIONS);
+                pindex->nStatus |= BLOCK_ASSUMED_VALID;
+            }
+            setDirtyBlockIndex.insert(pindex);
+        }
+        chainActive.SetTip(pindexBase);
+        setBlockIndexCandidates.insert(pindexBase);
+        PruneBlockIndexCandidates();
+        pblocktree->WriteFlag("prunedblockfiles", true);
+        fHavePruned = true;
+
+        statsSnapshot.hashBlock = info.hashBlock;
+        if (!pblocktree->WriteSnapshotStats(statsSnapshot))
+            return error("%s: failed to write to block index database", __func__);
+        OpenSnapshotValidation(true);
+        pcoinsSnapshot->SetBestBlock(chainparams.GetConsensus().hashGenesisBlock);
+        pindexSnapshotBase = pindexBase;
+        pindexSnapshotValidated = chainActive.Genesis();
+    }
+    CValidationState state;
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return error("%s: %s", __func__, FormatStateMessage(state));
+    pblocktree->WriteFlag("loadingsnapshot", false);
+
+    LogPrintf("Loaded UTXO snapshot: %.2fs\n", (GetTimeMicros() - nStart) * 0.000001);
+    return true;
+}
+
+bool LoadSnapshotValidation()
+{
+    LOCK(cs_main);
+    boost::filesystem::path path = GetDataDir() / SNAPSHOT_CHAINSTATE_DIR;
+    CUTXOStats statsSnapshot;
+    if (!pblocktree->ReadSnapshotStats(statsSnapshot)) {
+        // Left behind if the node stopped just after finishing the validation
+        try {
+            boost::filesystem::remove_all(path);
+        } catch (const boost::filesystem::filesystem_error& e) {
+            LogPrintf("Unable to remove %s: %s\n", path.string(), e.what());
+        }
+        return true;
+    }
+    BlockMap::iterator itBase = mapBlockIndex.find(statsSnapshot.hashBlock);
+    if (itBase == mapBlockIndex.end())
+        return error("%s: snapshot block %s not in the block index", __func__, statsSnapshot.hashBlock.ToString());
+    OpenSnapshotValidation(false);
+    BlockMap::iterator itValidated = mapBlockIndex.find(pcoinsSnapshot->GetBestBlock());
+    if (itValidated == mapBlockIndex.end() || itBase->second->GetAncestor(itValidated->second->nHeight) != itValidated->second) {
+        UnloadSnapshotValidation();
+        return error("%s: the snapshot validation chain state is not below the snapshot block", __func__);
+    }
+    pindexSnapshotBase = itBase->second;
+    pindexSnapshotValidated = itValidated->second;
+    LogPrintf("Validating the blocks below the UTXO snapshot at height %d, at height %d so far\n", pindexSnapshotBase->nHeight, pindexSnapshotValidated->nHeight);
+    return true;
+}
+
+//! Compare the validated chain state with the snapshot and, if they match, mark the history below it as validated
+static bool FinishSnapshotValidation()
+{
+    CValidationState state;
+    CCoinsStats stats;
+    {
+        LOCK(cs_main);
+        if (!pcoinsSnapshot->Flush())
+            return AbortNode(state, "Failed to write to snapshot validation database");
+    }
+    // Nothing else writes to the validation chain state, so it can be walked without cs_main
+    std::vector<std::unique_ptr<CCoinsViewCursor> > cursors;
+    OpenUTXOStatsCursors(pcoinsSnapshotDB.get(), cursors);
+    if (!ComputeUTXOStats(cursors, stats))
+        return false;
+    cursors.clear();
+
+    LOCK(cs_main);
+    CUTXOStats statsSnapshot;
+    if (!pblocktree->ReadSnapshotStats(statsSnapshot))
+        return AbortNode(state, "Failed to read from block index database");
+    if (stats.utxo.nTransactionOutputs != statsSnapshot.nTransactionOutputs ||
+        stats.utxo.nTotalAmount != statsSnapshot.nTotalAmount ||
+        stats.utxo.GetHash() != statsSnapshot.GetHash()) {
+        return AbortSnapshotInvalid(state, strprintf("UTXO snapshot does not match the validated UTXO set at block %s", statsSnapshot.hashBlock.ToString()));
+    }
+
+    for (CBlockIndex* pindex = pindexSnapshotBase; pindex->pprev; pindex = pindex->pprev) {
+        if (pindex->nStatus & BLOCK_ASSUMED_VALID) {
+            pindex->nStatus &= ~BLOCK_ASSUMED_VALID;
+            pindex->RaiseValidity(BLOCK_VALID_SCRIPTS);
+            setDirtyBlockIndex.insert(pindex);
+        }
+    }
+    int nHeight = pindexSnapshotBase->nHeight;
+    UnloadSnapshotValidation();
+    if (!FlushStateToDisk(state, FLUSH_STATE_ALWAYS))
+        return false;
+    if (!pblocktree->EraseSnapshotStats())
+        return AbortNode(state, "Failed to write to block index database");
+    boost::filesystem::path path = GetDataDir() / SNAPSHOT_CHAINSTATE_DIR;
+    try {
+        boost::filesystem::remove_all(path);
+    } catch (const boost::filesystem::filesystem_error& e) {
+        LogPrintf("Unable to remove %s: %s\n", path.string(), e.what());
+    }
+    LogPrintf("Validated the blocks below the UTXO snapshot at height %d, the snapshot matches\n", nHeight);
+    return true;
+}
+
+bool ValidateSnapshotBlocks(const CChainParams& chainparams)
+{
+    while (true) {
+        boost::this_thread::interruption_point();
+        LOCK(cs_main);
+        if (!pindexSnapshotBase)
+            return true;
+        if (pindexSnapshotValidated == pindexSnapshotBase)
+            break;
+        CBlockIndex* pindex = pindexSnapshotBase->GetAncestor(pindexSnapshotValidated->nHeight + 1);
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA))
+            return true;
+
+        CBlock block;
+        CValidationState state;
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            return AbortNode(state, "Failed to read block");
+        // Connect the block to the validation chain state only
+        if (!CheckBlock(block, state, chainparams.GetConsensus(), true, true, GetTrustedPoWHash(block, pindex)) ||
+            !ConnectBlock(block, state, pindex, *pcoinsSnapshot, chainparams, true)) {
+            if (state.IsInvalid())
+                return AbortSnapshotInvalid(state, strprintf("Invalid block %s below the UTXO snapshot: %s", pindex->GetBlockHash().ToString(), FormatStateMessage(state)));
+            return AbortNode(state, strprintf("Failed to validate block %s below the UTXO snapshot: %s", pindex->GetBlockHash().ToString(), FormatStateMessage(state)));
+        }
+        pcoinsSnapshot->SetBestBlock(pindex->GetBlockHash());
+        pindexSnapshotValidated = pindex;
+        if (pcoinsSnapshot->DynamicMemoryUsage() > nCoinCacheUsage / 4 && !pcoinsSnapshot->Flush())
+            return AbortNode(state, "Failed to write to snapshot validation database");
+        if (pindex->nHeight % 10000 == 0)
+            LogPrintf("Validated the blocks below the UTXO snapshot up to height %d\n", pindex->nHeight);
+    }
+    return FinishSnapshotValidation();
+}
+
+void ThreadValidateSnapshot()
+{
+    RenameThread("bitcoin-snapshot");
+    const CChainParams& chainparams = Params();
+    while (ValidateSnapshotBlocks(chainparams)) {
+        {
+            LOCK(cs_main);
+            if (!pindexSnapshotBase)
+                return;
+        }
+        // Wait for more blocks to be downloaded
+        MilliSleep(1000);
+    }
+}
+
 //! Guess how far we are in the verification process at the given block index
 double GuessVerificationProgress(const ChainTxData& data, CBlockIndex *pindex) {
     if (pindex == NULL)
@@ -13,6 +13,7 @@
 #include "amount.h"
 #include "chain.h"
 #include "coins.h"
+#include "coinstats.h"
 #include "protocol.h" // For CMessageHeader::MessageStartChars
 #include "script/script_error.h"
 #include "sync.h"
@@ -36,6 +37,7 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsViewWriteBehind;
 class CInv;
 class CConnman;
 class CScriptCheck;
@@ -131,6 +133,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+/** Default for -checkblockreadpow */
+static const bool DEFAULT_CHECK_BLOCK_READ_POW = false;
 static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
@@ -139,6 +143,9 @@ static const bool DEFAULT_ENABLE_REPLACEMENT = true;
 /** Default for using fee filter */
 static const bool DEFAULT_FEEFILTER = true;
 
+/** Number of block index entries hashed per batch when backfilling stored proof-of-work hashes. */
+static const size_t POW_BACKFILL_BATCH_SIZE = 1000;
+
 /** Maximum number of headers to announce when relaying blocks with headers message.*/
 static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 
@@ -171,6 +178,8 @@ extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Recompute the scrypt hash of blocks read from disk even if their index entry stores it */
+extern bool fCheckBlockReadPoW;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -263,6 +272,10 @@ bool LoadBlockIndex(const CChainParams& chainparams);
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the thread reading block inputs from disk ahead of ConnectBlock */
+void ThreadPrefetchInputs();
+/** Compute and store the proof-of-work hash of block index entries loaded without one, invalidating those whose work does not check out */
+void ThreadBackfillBlockIndexPoW();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -277,6 +290,8 @@ std::string GetWarnings(const std::string& strFor);
 bool GetTransaction(const uint256 &hash, CTransactionRef &tx, const Consensus::Params& params, uint256 &hashBlock, bool fAllowSlow = false);
 /** Find the best known block, and make it the tip of the block chain */
 bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams, std::shared_ptr<const CBlock> pblock = std::shared_ptr<const CBlock>());
+/** Number of blocks that ActivateBestChain connected after reading them ahead in the background */
+uint64_t GetPreparedBlocksConnected();
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams);
 
 /** Guess verification progress (as a fraction between 0.0=genesis and 1.0=current tip). */
@@ -324,6 +339,17 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
                         bool* pfMissingInputs, std::list<CTransactionRef>* plTxnReplaced = NULL,
                         bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/**
+ * Verify the scripts of transactions that are about to be passed to
+ * AcceptToMemoryPool on the script check threads, without holding cs_main
+ * while they run. The valid signatures end up in the signature cache, so
+ * AcceptToMemoryPool only has to look them up. Transactions that its cheaper
+ * checks would reject, with the same nAbsurdFee, are skipped. Does nothing
+ * without -par threads. Returns the number of transactions whose scripts
+ * were checked.
+ */
+size_t PrevalidateTransactions(CTxMemPool& pool, const std::vector<CTransactionRef>& vtx, CAmount nAbsurdFee=0);
+
 /** (try to) add transaction to memory pool with a specified acceptance time **/
 bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransactionRef &tx, bool fLimitFree,
                         bool* pfMissingInputs, int64_t nAcceptTime, std::list<CTransactionRef>* plTxnReplaced = NULL,
@@ -447,8 +473,8 @@ private:
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -475,9 +501,9 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
 
 /** Functions for validating blocks and updating the block tree */
 
-/** Context-independent validity checks */
-bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true);
-bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
+/** Context-independent validity checks. If phashPoW is given, it is used as the (already computed) scrypt hash of the header. */
+bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, const uint256* phashPoW = NULL);
+bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW = true, bool fCheckMerkleRoot = true, const uint256* phashPoW = NULL);
 
 /** Context-dependent validity checks.
  *  By "context", we mean only the previous block headers, but not the UTXO
@@ -489,13 +515,13 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, const Co
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
  *  can fail if those validity checks fail (among other reasons). */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CUTXOStats* pstats = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
  *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CUTXOStats* pstats = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -538,9 +564,25 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/** The background writer below pcoinsTip when -backgroundflush is enabled, otherwise NULL (protected by cs_main) */
+extern CCoinsViewWriteBehind *pcoinsWriteBehind;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
+/** Statistics of the UTXO set at the tip, updated as blocks are connected and disconnected (protected by cs_main) */
+extern CUTXOStats utxoStats;
+
+/** Whether utxoStats covers the whole UTXO set. While they are being rebuilt, they only
+ *  hold the changes since the rebuild started. (protected by cs_main) */
+extern bool fUTXOStatsComplete;
+
+/** The block of a loaded UTXO snapshot whose history is still being validated, otherwise NULL (protected by cs_main) */
+extern CBlockIndex *pindexSnapshotBase;
+
+/** The last block below pindexSnapshotBase validated so far (protected by cs_main) */
+extern CBlockIndex *pindexSnapshotValidated;
+
 /**
  * Return the spend height, which is one more than the inputs.GetBestBlock().
  * While checking, GetBestBlock() refers to the parent block. (protected by cs_main)
@@ -576,4 +618,57 @@ void DumpMempool();
 /** Load the mempool from disk. */
 bool LoadMempool();
 
+/** Load utxoStats from the block tree database. Returns false if they are missing or don't match the chain state. */
+bool LoadUTXOStats();
+
+/** Rebuild utxoStats from the chain state database while blocks keep being connected. */
+void ThreadRebuildUTXOStats();
+
+/**
+ * Compute the statistics of the UTXO set at the tip with a full (parallel)
+ * walk over the chain state database. If pmaintained is given, it receives
+ * utxoStats as of the same block, or a null hashBlock if they aren't complete.
+ */
+bool GetUTXOStats(CCoinsStats& stats, CUTXOStats* pmaintained = NULL);
+
+/** Summary of a UTXO set snapshot file */
+struct CSnapshotInfo
+{
+    uint256 hashBlock; //!< The block the snapshot was taken at
+    int nHeight;
+    uint64_t nCoins;
+    uint256 hashContent; //!< Hash of the file contents, stored at its end
+
+    CSnapshotInfo() : nHeight(0), nCoins(0) {}
+};
+
+/** Write the UTXO set at the current tip, with the headers leading to it, to a snapshot file. */
+bool DumpSnapshot(const boost::filesystem::path& path, CSnapshotInfo& info);
+
+/**
+ * Bootstrap an empty chain state from a snapshot written by DumpSnapshot,
+ * which must have the content hash hashExpected. The history below the
+ * snapshot block is treated as pruned and assumed valid until
+ * ValidateSnapshotBlocks has checked it against the snapshot.
+ * Must be called after the block index is loaded and before the chain is activated.
+ */
+bool LoadSnapshot(const boost::filesystem::path& path, const uint256& hashExpected, const CChainParams& chainparams);
+
+/** Resume the validation of the history below a loaded snapshot, if it has not finished yet. */
+bool LoadSnapshotValidation();
+
+/** Close the chain state used to validate the history below a loaded snapshot. */
+void UnloadSnapshotValidation();
+
+/**
+ * Connect the downloaded blocks below a loaded snapshot to a separate chain
+ * state starting at the genesis block. Once it reaches the snapshot block,
+ * its UTXO set must match the snapshot, and the blocks below it are marked
+ * as validated. Returns false on failure, which also shuts the node down.
+ */
+bool ValidateSnapshotBlocks(const CChainParams& chainparams);
+
+/** Run ValidateSnapshotBlocks as blocks arrive, until the history below the snapshot is validated. */
+void ThreadValidateSnapshot();
+
 #endif // BITCOIN_VALIDATION_H
@@ -2694,13 +2694,14 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
         if (sign)
         {
             CTransaction txNewConst(txNew);
+            const PrecomputedTransactionData txdata(txNewConst);
             int nIn = 0;
             for (const auto& coin : setCoins)
             {
                 const CScript& scriptPubKey = coin.first->tx->vout[coin.second].scriptPubKey;
                 SignatureData sigdata;
 
-                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->tx->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata))
+                if (!ProduceSignature(TransactionSignatureCreator(this, &txNewConst, nIn, coin.first->tx->vout[coin.second].nValue, SIGHASH_ALL, &txdata), scriptPubKey, sigdata))
                 {
                     strFailReason = _("Signing transaction failed");
                     return false;